@@ -0,0 +1,333 @@
+#ifndef ADXL345_H
+#define ADXL345_H
+
+#include <linux/atomic.h>
+#include <linux/device.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/kthread.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/pm.h>
+#include <linux/regmap.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+// Written against the 6.12 LTS APIs (the Raspberry Pi kernel's rpi-6.12.y)
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0)
+#error "adxl345 needs Linux 6.12 or later"
+#endif
+
+#include "adxl345_ioctl.h"
+
+#define N_ADXL345_MINORS 15  // Adjust as needed
+#define ADXL345_GROUP_MINOR N_ADXL345_MINORS
+
+#define ADXL345_REG_DEVID       0x00
+#define ADXL345_REG_THRESH_TAP  0x1D
+#define ADXL345_REG_DUR         0x21
+#define ADXL345_REG_LATENT      0x22
+#define ADXL345_REG_WINDOW      0x23
+#define ADXL345_REG_THRESH_ACT  0x24
+#define ADXL345_REG_THRESH_INACT 0x25
+#define ADXL345_REG_TIME_INACT  0x26
+#define ADXL345_REG_ACT_INACT_CTL 0x27
+#define ADXL345_REG_THRESH_FF   0x28
+#define ADXL345_REG_TIME_FF     0x29
+#define ADXL345_REG_TAP_AXES    0x2A
+#define ADXL345_REG_ACT_TAP_STATUS 0x2B
+#define ADXL345_REG_BW_RATE     0x2C
+#define ADXL345_REG_PWR_CTL     0x2D
+#define ADXL345_REG_INT_ENABLE  0x2E
+#define ADXL345_REG_INT_MAP     0x2F
+#define ADXL345_REG_INT_SOURCE  0x30
+#define ADXL345_REG_DATA_FORMAT 0x31
+#define ADXL345_REG_DATAX0       0x32
+#define ADXL345_REG_DATAZ1      0x37
+#define ADXL345_REG_FIFO_CTL    0x38
+#define ADXL345_REG_FIFO_STATUS 0x39
+#define ADXL345_REG_MAX         0x39
+
+#define ADXL345_INT_EVENTS      ADXL345_EVENT_ALL   // Same bit positions as INT_SOURCE
+#define ADXL345_INT_WATERMARK   BIT(1)
+#define ADXL345_INT_OVERRUN     BIT(0)
+
+#define ADXL345_FIFO_BYPASS     (0 << 6)
+#define ADXL345_FIFO_STREAM     (2 << 6)
+#define ADXL345_FIFO_ENTRIES(x) ((x) & 0x3F)
+#define ADXL345_FIFO_DEPTH      32
+
+#define ADXL345_SAMPLE_SIZE     6   // DATAX0..DATAZ1, one FIFO entry
+
+#define ADXL345_BW_RATE_MASK    0x0F
+#define ADXL345_BW_RATE_MAX     0x0F    // 3200 Hz, each lower code halves the rate
+#define ADXL345_BW_RATE_DEFAULT 0x0A    // 100 Hz, the reset value
+#define ADXL345_BW_RATE_LOW_POWER BIT(4)
+
+#define ADXL345_DATA_FORMAT_RANGE    0x03   // 0: 2 g, 1: 4 g, 2: 8 g, 3: 16 g
+#define ADXL345_DATA_FORMAT_FULL_RES BIT(3)
+
+#define ADXL345_PWR_CTL_LINK    BIT(5)  // Activity and inactivity alternate
+#define ADXL345_PWR_CTL_MEASURE BIT(3)
+
+#define ADXL345_ACT_AC          BIT(7)  // ACT_INACT_CTL; axes in bits 6..4 and 2..0
+#define ADXL345_INACT_AC        BIT(3)
+#define ADXL345_TAP_SUPPRESS    BIT(3)  // TAP_AXES; axes in bits 2..0
+
+#define ADXL345_EVENT_QUEUE     32
+
+/*
+ * Register access supplied by a transport module (I2C, SPI). bus is the
+ * pointer the transport passed to adxl345_core_probe(). All callbacks may
+ * sleep and are serialized by the core, except the optional async pair.
+ */
+struct adxl345_bus_ops {
+    int (*read_regs)(void *bus, u8 reg, u8 *buf, size_t len);
+    int (*write_reg)(void *bus, u8 reg, u8 val);
+    /*
+     * Pop entries samples from the FIFO into buf, ADXL345_SAMPLE_SIZE bytes
+     * each. buf is DMA-safe: it starts on its own cacheline in kmalloc'd
+     * memory, so it can be handed to the controller as is.
+     */
+    int (*burst_read)(void *bus, u8 *buf, unsigned int entries);
+    /*
+     * Optional. Called from the hard IRQ with the watermark IRQ disabled:
+     * queue a drain of entries samples without sleeping, hand the samples
+     * to adxl345_core_push() on completion and finish with
+     * adxl345_core_drain_done(). Returns < 0 if nothing was queued.
+     */
+    int (*drain_async)(void *bus, unsigned int entries, s64 timestamp);
+    // Optional. Wait for every queued async drain to complete
+    void (*drain_flush)(void *bus);
+};
+
+/*
+ * Single-producer, multi-reader sample ring. Only the producer moves
+ * head, after reserving room under readers_lock. Every attached read()
+ * file has its own tail in struct adxl345_reader, and ctrl->tail is one
+ * more cursor while the ring is mapped or grouped. Readers copy without a
+ * lock and commit their tail with cmpxchg(), redoing the copy if the
+ * producer pushed a SKIP reader forward meanwhile. head/tail live in the
+ * mmap-able control page in front of the samples.
+ */
+struct adxl345_ring {
+    void *area;                     // vmalloc_user(): control page + samples
+    size_t area_size;
+    struct adxl345_ring_ctrl *ctrl;
+    struct adxl345_sample *samples;
+    unsigned int size;              // Power of two
+    bool lost;                      // Producer only: flag the next stored sample
+    bool rate_changed;              // Likewise, set while no producer runs
+    unsigned int backlog;           // Producer only: largest cursor backlog after the last push
+};
+
+struct adxl345_group;
+
+#define ADXL345_CIC_MAX_ORDER   4
+
+/*
+ * Cascaded integrator-comb decimator, run on FIFO batches before they
+ * reach the ring. Integrators and combs wrap modulo 2^64, which is exact
+ * as long as 13 + order * shift bits fit. Producer only; reset whenever
+ * the stream (re)starts.
+ */
+struct adxl345_decimator {
+    unsigned int order;             // Stages, 1..ADXL345_CIC_MAX_ORDER
+    unsigned int shift;             // log2 of the ratio; 0 bypasses the stage
+    unsigned int phase;             // Inputs since the last output
+    u64 integ[ADXL345_CIC_MAX_ORDER][3];
+    u64 comb[ADXL345_CIC_MAX_ORDER][3];
+    u8 raw[ADXL345_FIFO_DEPTH * ADXL345_SAMPLE_SIZE];     // Decimated entries, FIFO layout
+};
+
+/*
+ * Per-sample timestamp model. A FIFO batch only carries the time its IRQ
+ * fired; the entries are spread back from there by the sample period, and
+ * the period is tracked against the IRQ times so that timestamps follow the
+ * sensor's own oscillator rather than the nominal ODR. Producer only;
+ * reset whenever the stream (re)starts.
+ */
+struct adxl345_timing {
+    u64 nominal_q16;                // ns per sample from BW_RATE, << 16
+    u64 period_q16;                 // Filtered estimate, << 16
+    s64 last_irq;
+    s64 last_ts;                    // Timestamp of the newest sample pushed
+    bool valid;                     // last_irq/last_ts describe the stream
+};
+
+/*
+ * Consumer state for the packed read() format: where the last anchor put
+ * the timeline, so the next one is only emitted when due.
+ */
+struct adxl345_packer {
+    u32 format;                     // ADXL345_FORMAT_*
+    u32 anchor_interval;
+    unsigned int since_anchor;      // Samples emitted since the last anchor
+    bool need_anchor;               // Force one before the next sample
+    s64 anchor_ts;
+    u32 period_ns;
+};
+
+#define ADXL345_PACK_CHUNK      (64 * sizeof(struct adxl345_axes))
+
+/*
+ * One open read() file: its own cursor into the shared ring, so any number
+ * of consumers see every sample while the sensor is drained only once.
+ * The producer walks the attached readers under readers_lock; it reads
+ * tail, and for a SKIP reader pushes it forward with cmpxchg, so the
+ * consumer commits its tail with cmpxchg too and retries a copy whose
+ * slots were reclaimed underneath it.
+ */
+struct adxl345_reader {
+    struct adxl345_data *adxl345;
+    struct list_head entry;         // In adxl345->readers once attached
+    struct mutex lock;              // Serializes read() and the settings below
+    u32 tail;
+    u32 skips;                      // Producer: times tail was pushed forward
+    u32 seen_skips;                 // Consumer: skips already flagged
+    u32 policy;                     // ADXL345_READER_*, changed under readers_lock
+    bool attached;
+    bool detached;                  // DETACH reader fell behind
+    bool mapped;                    // mmap()ed: poll() follows the shared ctrl tail
+    u64 dropped;                    // Producer, under readers_lock
+    struct adxl345_packer packer;
+    u8 pack_buf[ADXL345_PACK_CHUNK] __aligned(8);   // Packed records staged for copy_to_user
+    struct adxl345_sample fifo_buf[ADXL345_FIFO_READ_MAX];  // READ_FIFO samples, under lock
+};
+
+#define ADXL345_LATENCY_BUCKETS 16
+
+/*
+ * Acquisition counters. Samples lost to a slow consumer are the ring's
+ * overruns; these tell the bus and the sensor FIFO apart from that. The
+ * plain fields are written by the producer only.
+ */
+struct adxl345_stats {
+    u64 samples;                    // FIFO entries drained
+    u64 fifo_overruns;              // Drains that found the hardware FIFO had overflowed
+    atomic64_t bus_errors;          // Failed register, burst or async transfers
+    atomic64_t retries;             // Drains left to the next IRQ: no async transfer was free
+    // Wake-up (IRQ or poll timer) to ring, bucket n counting [2^(n-1), 2^n) us; the last is open-ended
+    u64 irq_latency[ADXL345_LATENCY_BUCKETS];
+    // IRQ or poll timer to the acquisition thread's first bus transfer, same buckets
+    u64 wake_latency[ADXL345_LATENCY_BUCKETS];
+};
+
+/*
+ * One row of the scale table, picked whenever DATA_FORMAT is written so
+ * the sample paths only multiply and shift.
+ */
+struct adxl345_scale_entry {
+    u32 ug_per_lsb;
+    u32 nms2_per_lsb;
+    u32 ms2_q16;                    // m/s^2 per LSB in Q16.16 for the legacy READ_X/Y/Z
+};
+
+// One IIO scan: the three axes as they come out of the FIFO, then the timestamp
+struct adxl345_scan {
+    __le16 channels[3];
+    s64 timestamp __aligned(8);
+};
+
+// Define data structure for ADXL345
+struct adxl345_data 
+{
+    dev_t devt;
+    struct device *dev;             // Parent bus device
+    const struct adxl345_bus_ops *ops;
+    void *bus;                      // NULL once the transport has been removed
+    struct regmap *regmap;          // Cached register access on top of ops, locked by bus_lock
+    int irq;
+    struct list_head device_entry;
+    unsigned users;
+    struct mutex bus_lock;          // Serializes ops and regmap calls against removal
+    struct mutex buf_lock;          // tx_buffer and sample_raw
+    struct mutex lock;              // Stream state
+    struct list_head readers;       // Attached struct adxl345_reader
+    spinlock_t readers_lock;        // readers, and taken by the producer around a push
+    atomic_t mappings;              // Live mmap()s: ctrl->tail is a cursor while > 0
+    wait_queue_head_t wait;
+    struct adxl345_ring ring;
+    bool streaming;
+    bool fifo_polled;               // FIFO in stream mode for READ_FIFO, holds a PM reference
+    bool iio_active;                // IIO buffer enabled, keeps streaming on
+    bool removed;                   // Set under lock by core_remove: no stream may start
+    struct adxl345_group *group;    // Set while a group fd consumes this ring
+    unsigned int wakeup;            // Samples buffered before readers are woken
+    u8 data_format;                 // Lock-free mirrors of the cached DATA_FORMAT ...
+    u8 bw_rate;                     // ... BW_RATE ...
+    const struct adxl345_scale_entry *scale;    // Follows data_format
+    struct adxl345_timing timing;
+    struct adxl345_decimator decim;
+    u8 int_enable;                  // ... and INT_ENABLE, read from IRQ context
+    u8 event_mask;                  // Detection engines routed to the IRQ
+    struct adxl345_event_config event_config;
+    DECLARE_KFIFO(events, struct adxl345_event, ADXL345_EVENT_QUEUE);
+    spinlock_t event_lock;          // events and events_lost, producers and consumers
+    u64 events_lost;
+    // Autosleep: drop to a low-power rate on inactivity, restore it on activity
+    bool autosleep;
+    bool want_sleep;                // Set by the acquisition thread
+    bool asleep;                    // sleep_work only
+    u8 awake_rate;                  // BW_RATE to restore on activity
+    struct work_struct sleep_work;
+    bool boottime;                  // Timestamps from CLOCK_BOOTTIME instead of CLOCK_MONOTONIC
+    struct adxl345_stats stats;
+    /*
+     * Acquisition thread: runs every drain the transport cannot do
+     * asynchronously, woken by the IRQ or, without one, by acq_timer
+     * every watermark's worth of samples.
+     */
+    struct kthread_worker *acq_worker;
+    struct kthread_work acq_work;
+    struct hrtimer acq_timer;
+    ktime_t acq_interval;
+    s64 acq_wake;                   // When the IRQ or the timer last fired
+    int acq_cpu;                    // CPU the thread is bound to, -1 for any
+    unsigned int acq_priority;      // SCHED_FIFO priority, 0 for SCHED_NORMAL
+    struct dentry *debugfs;
+    struct iio_dev *indio_dev;
+    struct adxl345_scan scan;       // Producer only
+
+    /*
+     * Transfer buffers, allocated with the struct at probe so the sample
+     * paths never allocate. Each starts on its own cacheline and nothing
+     * else shares their lines, which makes them DMA-safe for the transports.
+     */
+    u8 fifo_raw[ADXL345_FIFO_DEPTH * ADXL345_SAMPLE_SIZE] ____cacheline_aligned;
+    u8 sample_raw[ADXL345_SAMPLE_SIZE] ____cacheline_aligned;
+    u8 tx_buffer[ADXL345_REG_MAX + 2] ____cacheline_aligned;
+};
+
+// Function prototypes
+
+// Bind a device found by a transport; returns the core state or an ERR_PTR
+struct adxl345_data *adxl345_core_probe(struct device *dev, const struct adxl345_bus_ops *ops,
+                                        void *bus, int irq);
+
+// Unbind; called from the transport's remove before its bus data goes away
+void adxl345_core_remove(struct adxl345_data *adxl345);
+
+// Count a transfer the transport failed outside the core's own bus calls; safe in any context
+void adxl345_core_bus_error(struct adxl345_data *adxl345, int err);
+
+// Current time in the clock the device timestamps with; safe in any context
+s64 adxl345_core_timestamp(struct adxl345_data *adxl345);
+
+/*
+ * Deliver drained FIFO entries to the ring and IIO buffer; safe in atomic
+ * context. timestamp is adxl345_core_timestamp() taken when the watermark
+ * IRQ fired (or just before the FIFO was found to hold entries), and
+ * overrun reports that the hardware FIFO overflowed beforehand.
+ */
+void adxl345_core_push(struct adxl345_data *adxl345, const u8 *raw, unsigned int entries,
+                       s64 timestamp, bool overrun);
+
+// An async drain chain has ended; re-arm the watermark IRQ
+void adxl345_core_drain_done(struct adxl345_data *adxl345);
+
+// Runtime PM (standby) and system sleep (register cache replay) for the transports' drivers
+extern const struct dev_pm_ops adxl345_pm_ops;
+
+#endif // ADXL345_H
@@ -0,0 +1,2955 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/timekeeping.h>
+#include <linux/interrupt.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <uapi/linux/sched/types.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/pm_runtime.h>
+#include <linux/delay.h>
+#include <linux/regmap.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/unaligned.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/kfifo_buf.h>
+
+#include "adxl345.h"
+
+#define CREATE_TRACE_POINTS
+#include "adxl345_trace.h"
+
+#define CLASS_NAME      "adxl345"
+#define DEVICE_NAME     "adxl345"
+#define AUTOSUSPEND_MS  2000
+
+static unsigned int watermark = 16;
+module_param(watermark, uint, 0444);
+MODULE_PARM_DESC(watermark, "FIFO watermark in samples for streaming mode (1-31)");
+
+static unsigned int sleep_rate = 0x07;
+module_param(sleep_rate, uint, 0644);
+MODULE_PARM_DESC(sleep_rate, "BW_RATE code used while autosleep sees inactivity (default 12.5 Hz)");
+
+static unsigned int buffer_samples = 1024;
+module_param(buffer_samples, uint, 0444);
+MODULE_PARM_DESC(buffer_samples, "Sample ring size, rounded up to a power of two");
+
+static DECLARE_BITMAP(minors, N_ADXL345_MINORS);
+static struct class *adxl345_class;
+static int major_number;
+
+// Timestamp model: period bound (+-1/16 of nominal), period filter and phase pull weights
+#define ADXL345_TIMING_TOLERANCE_SHIFT  4
+#define ADXL345_TIMING_FILTER_SHIFT     4
+#define ADXL345_TIMING_PHASE_SHIFT      3
+
+static LIST_HEAD(device_list);
+static DEFINE_MUTEX(device_list_lock);
+
+// Woken whenever a sensor that belongs to a group gets new samples
+static DECLARE_WAIT_QUEUE_HEAD(group_wait);
+
+// debugfs root; one directory per sensor, named like its char device
+static struct dentry *adxl345_debugfs;
+
+// Per-fd state of /dev/adxl345_group
+struct adxl345_group {
+    struct mutex lock;
+    struct adxl345_data *members[N_ADXL345_MINORS];
+    unsigned int count;
+    s64 tolerance_ns;
+    bool lost;
+};
+
+#define ADXL345_SCALE(ug) {                                             \
+    .ug_per_lsb = (ug),                                                 \
+    .nms2_per_lsb = (ug) * 980665ULL / 100000,                          \
+    .ms2_q16 = ((ug) * 980665ULL * 65536 + 50000000000ULL) / 100000000000ULL, \
+}
+
+// Datasheet typical sensitivity; full resolution keeps 3.9 mg/LSB at every range
+static const struct adxl345_scale_entry adxl345_scales[] = {
+    ADXL345_SCALE(3900),    // +-2 g, or any range at full resolution
+    ADXL345_SCALE(7800),    // +-4 g, 10 bit
+    ADXL345_SCALE(15600),   // +-8 g, 10 bit
+    ADXL345_SCALE(31200),   // +-16 g, 10 bit
+};
+
+static const struct adxl345_scale_entry *adxl345_scale_lookup(u8 data_format)
+{
+    if (data_format & ADXL345_DATA_FORMAT_FULL_RES)
+        return &adxl345_scales[0];
+    return &adxl345_scales[data_format & ADXL345_DATA_FORMAT_RANGE];
+}
+
+// Clock reads for the trace durations only happen while the event is enabled
+static u64 adxl345_trace_clock(bool enabled)
+{
+    return enabled ? ktime_get_ns() : 0;
+}
+
+/*
+ * Register access goes through a regmap on top of the transport, so the
+ * configuration registers are cached and their writes skipped when the
+ * value is unchanged. The regmap lock is bus_lock and the bus callbacks
+ * return -ENODEV once the transport has been removed.
+ */
+static int adxl345_regmap_read(void *context, const void *reg, size_t reg_size,
+                               void *val, size_t val_size)
+{
+    struct adxl345_data *adxl345 = context;
+    bool traced = trace_adxl345_bus_read_enabled();
+    u64 start = adxl345_trace_clock(traced);
+    u8 addr = *(const u8 *)reg;
+    int ret;
+
+    if (!adxl345->bus)
+        return -ENODEV;
+    ret = adxl345->ops->read_regs(adxl345->bus, addr, val, val_size);
+    if (ret < 0)
+        atomic64_inc(&adxl345->stats.bus_errors);
+    if (traced)
+        trace_adxl345_bus_read(adxl345->dev, addr, val_size, ret, ktime_get_ns() - start);
+    return ret;
+}
+
+static int adxl345_regmap_write(void *context, const void *data, size_t count)
+{
+    struct adxl345_data *adxl345 = context;
+    bool traced = trace_adxl345_bus_write_enabled();
+    const u8 *buf = data;
+    u64 start;
+    size_t i;
+    int ret = 0;
+
+    if (!adxl345->bus)
+        return -ENODEV;
+    for (i = 1; i < count && ret == 0; i++) {
+        start = adxl345_trace_clock(traced);
+        ret = adxl345->ops->write_reg(adxl345->bus, buf[0] + i - 1, buf[i]);
+        if (ret < 0)
+            atomic64_inc(&adxl345->stats.bus_errors);
+        if (traced)
+            trace_adxl345_bus_write(adxl345->dev, buf[0] + i - 1, buf[i], ret,
+                                    ktime_get_ns() - start);
+    }
+    return ret;
+}
+
+static const struct regmap_bus adxl345_regmap_bus = {
+    .read = adxl345_regmap_read,
+    .write = adxl345_regmap_write,
+};
+
+static void adxl345_regmap_lock(void *arg)
+{
+    struct adxl345_data *adxl345 = arg;
+
+    mutex_lock(&adxl345->bus_lock);
+}
+
+static void adxl345_regmap_unlock(void *arg)
+{
+    struct adxl345_data *adxl345 = arg;
+
+    mutex_unlock(&adxl345->bus_lock);
+}
+
+static bool adxl345_readable_reg(struct device *dev, unsigned int reg)
+{
+    return reg == ADXL345_REG_DEVID ||
+           (reg >= ADXL345_REG_THRESH_TAP && reg <= ADXL345_REG_MAX);
+}
+
+static bool adxl345_writeable_reg(struct device *dev, unsigned int reg)
+{
+    return (reg >= ADXL345_REG_THRESH_TAP && reg <= ADXL345_REG_TAP_AXES) ||
+           (reg >= ADXL345_REG_BW_RATE && reg <= ADXL345_REG_INT_MAP) ||
+           reg == ADXL345_REG_DATA_FORMAT || reg == ADXL345_REG_FIFO_CTL;
+}
+
+static bool adxl345_volatile_reg(struct device *dev, unsigned int reg)
+{
+    return reg == ADXL345_REG_ACT_TAP_STATUS || reg == ADXL345_REG_INT_SOURCE ||
+           (reg >= ADXL345_REG_DATAX0 && reg <= ADXL345_REG_DATAZ1) ||
+           reg == ADXL345_REG_FIFO_STATUS;
+}
+
+// Reading these clears interrupt status or pops the FIFO
+static bool adxl345_precious_reg(struct device *dev, unsigned int reg)
+{
+    return reg == ADXL345_REG_INT_SOURCE ||
+           (reg >= ADXL345_REG_DATAX0 && reg <= ADXL345_REG_DATAZ1);
+}
+
+static const struct regmap_config adxl345_regmap_config = {
+    .reg_bits = 8,
+    .val_bits = 8,
+    .max_register = ADXL345_REG_MAX,
+    .readable_reg = adxl345_readable_reg,
+    .writeable_reg = adxl345_writeable_reg,
+    .volatile_reg = adxl345_volatile_reg,
+    .precious_reg = adxl345_precious_reg,
+    .cache_type = REGCACHE_MAPLE,       // Default choice since 6.4; the tree targets 6.12
+    .lock = adxl345_regmap_lock,
+    .unlock = adxl345_regmap_unlock,
+};
+
+static int adxl345_read_regs(struct adxl345_data *adxl345, u8 reg, u8 *buf, size_t len)
+{
+    return regmap_bulk_read(adxl345->regmap, reg, buf, len);
+}
+
+static int adxl345_read_reg(struct adxl345_data *adxl345, u8 reg)
+{
+    unsigned int val;
+    int ret;
+
+    ret = regmap_read(adxl345->regmap, reg, &val);
+    return ret < 0 ? ret : val;
+}
+
+static int adxl345_write_reg(struct adxl345_data *adxl345, u8 reg, u8 val)
+{
+    int ret;
+
+    // Compares against the cache, so rewriting a configured value costs no bus transfer
+    ret = regmap_update_bits(adxl345->regmap, reg, 0xFF, val);
+    if (ret < 0)
+        return ret;
+    // Keep the lock-free mirrors right even for raw write() passthrough
+    if (reg == ADXL345_REG_DATA_FORMAT) {
+        adxl345->data_format = val;
+        WRITE_ONCE(adxl345->scale, adxl345_scale_lookup(val));
+    } else if (reg == ADXL345_REG_BW_RATE) {
+        adxl345->bw_rate = val;
+    } else if (reg == ADXL345_REG_INT_ENABLE) {
+        WRITE_ONCE(adxl345->int_enable, val);
+    }
+    return 0;
+}
+
+// FIFO drains bypass the regmap: nothing to cache and no register address to format
+static int adxl345_burst_read(struct adxl345_data *adxl345, u8 *buf, unsigned int entries)
+{
+    bool traced = trace_adxl345_burst_read_enabled();
+    u64 start = adxl345_trace_clock(traced);
+    int ret = -ENODEV;
+
+    mutex_lock(&adxl345->bus_lock);
+    if (adxl345->bus) {
+        ret = adxl345->ops->burst_read(adxl345->bus, buf, entries);
+        if (ret < 0)
+            atomic64_inc(&adxl345->stats.bus_errors);
+    }
+    mutex_unlock(&adxl345->bus_lock);
+    if (traced)
+        trace_adxl345_burst_read(adxl345->dev, entries, ret, ktime_get_ns() - start);
+    return ret;
+}
+
+static int adxl345_ring_init(struct adxl345_ring *ring, unsigned int size)
+{
+    ring->size = roundup_pow_of_two(clamp(size, 2U * ADXL345_FIFO_DEPTH, 1U << 20));
+    ring->area_size = PAGE_ALIGN(PAGE_SIZE + ring->size * sizeof(struct adxl345_sample));
+    ring->area = vmalloc_user(ring->area_size);
+    if (!ring->area)
+        return -ENOMEM;
+    ring->ctrl = ring->area;
+    ring->samples = ring->area + PAGE_SIZE;
+    ring->ctrl->size = ring->size;
+    ring->ctrl->data_offset = PAGE_SIZE;
+    ring->ctrl->mmap_size = ring->area_size;
+    ring->lost = false;
+    return 0;
+}
+
+static void adxl345_ring_free(struct adxl345_ring *ring)
+{
+    vfree(ring->area);
+    ring->area = NULL;
+}
+
+// tail may come from userspace, so never trust head - tail to be <= size
+static unsigned int adxl345_ring_count(struct adxl345_ring *ring)
+{
+    return min(smp_load_acquire(&ring->ctrl->head) - READ_ONCE(ring->ctrl->tail), ring->size);
+}
+
+static void adxl345_decode(const u8 *raw, struct adxl345_sample *sample)
+{
+    sample->x = (s16)((raw[1] << 8) | raw[0]);
+    sample->y = (s16)((raw[3] << 8) | raw[2]);
+    sample->z = (s16)((raw[5] << 8) | raw[4]);
+    sample->flags = 0;
+}
+
+// Time of the sample back entries before the newest one of a batch
+static s64 adxl345_sample_time(s64 newest, u64 period_q16, unsigned int back)
+{
+    return newest - (s64)((back * period_q16) >> 16);
+}
+
+/*
+ * Make room for entries new samples at head. The slowest BLOCK reader, and
+ * the shared tail while the ring is mapped or grouped, cap what fits; SKIP
+ * readers about to be lapped are pushed forward and DETACH ones cut off.
+ * Returns how many entries fit. Caller holds readers_lock.
+ */
+static unsigned int adxl345_ring_reserve(struct adxl345_data *adxl345, unsigned int head,
+                                         unsigned int entries)
+{
+    struct adxl345_ring *ring = &adxl345->ring;
+    struct adxl345_reader *reader;
+    unsigned int used = 0, backlog, tail, old, end;
+
+    if (READ_ONCE(adxl345->group) || atomic_read(&adxl345->mappings))
+        used = head - smp_load_acquire(&ring->ctrl->tail);
+    list_for_each_entry(reader, &adxl345->readers, entry) {
+        if (reader->policy == ADXL345_READER_BLOCK)
+            used = max(used, head - smp_load_acquire(&reader->tail));
+    }
+    used = min(used, ring->size);
+    entries = min(entries, ring->size - used);
+    backlog = used + entries;
+    end = head + entries;
+
+    list_for_each_entry(reader, &adxl345->readers, entry) {
+        if (reader->policy == ADXL345_READER_BLOCK || reader->detached)
+            continue;
+        tail = READ_ONCE(reader->tail);
+        while (end - tail > ring->size) {
+            if (reader->policy == ADXL345_READER_DETACH) {
+                reader->dropped += end - tail;
+                WRITE_ONCE(reader->detached, true);
+                backlog = UINT_MAX;     // Wake it up to see EPIPE
+                break;
+            }
+            // A failed exchange means the consumer moved on meanwhile; look again
+            old = cmpxchg(&reader->tail, tail, end - ring->size);
+            if (old == tail) {
+                reader->dropped += end - ring->size - tail;
+                smp_store_release(&reader->skips, reader->skips + 1);
+                tail = end - ring->size;
+            } else {
+                tail = old;
+            }
+        }
+        if (!reader->detached)
+            backlog = max(backlog, end - tail);
+    }
+    ring->backlog = backlog;
+    return entries;
+}
+
+// Producer side: decode raw FIFO entries straight into the ring
+static void adxl345_ring_push(struct adxl345_data *adxl345, const u8 *raw, unsigned int entries,
+                              s64 newest, u64 period_q16)
+{
+    struct adxl345_ring *ring = &adxl345->ring;
+    unsigned int total = entries;
+    unsigned int head = ring->ctrl->head;
+    struct adxl345_sample *sample;
+    unsigned long flags;
+    unsigned int i;
+
+    spin_lock_irqsave(&adxl345->readers_lock, flags);
+    entries = adxl345_ring_reserve(adxl345, head, total);
+    spin_unlock_irqrestore(&adxl345->readers_lock, flags);
+
+    if (entries < total) {
+        WRITE_ONCE(ring->ctrl->overruns, ring->ctrl->overruns + total - entries);
+        ring->lost = true;
+    }
+
+    for (i = 0; i < entries; i++) {
+        sample = &ring->samples[(head + i) & (ring->size - 1)];
+        adxl345_decode(&raw[i * ADXL345_SAMPLE_SIZE], sample);
+        sample->timestamp_ns = adxl345_sample_time(newest, period_q16, total - 1 - i);
+        if (ring->lost) {
+            sample->flags |= ADXL345_SAMPLE_OVERRUN;
+            ring->lost = false;
+        }
+        if (ring->rate_changed) {
+            sample->flags |= ADXL345_SAMPLE_RATE_CHANGE;
+            ring->rate_changed = false;
+        }
+    }
+
+    // Publish the samples before the new head becomes visible
+    smp_store_release(&ring->ctrl->head, head + entries);
+}
+
+// Samples a reader has not consumed yet; none until its first read() or poll()
+static unsigned int adxl345_reader_count(struct adxl345_reader *reader)
+{
+    struct adxl345_ring *ring = &reader->adxl345->ring;
+
+    if (!READ_ONCE(reader->attached))
+        return 0;
+    return min(smp_load_acquire(&ring->ctrl->head) - READ_ONCE(reader->tail), ring->size);
+}
+
+/*
+ * Consumer side: copy up to max samples to userspace in at most two chunks.
+ * The tail only moves if the producer did not reclaim any of the slots
+ * while they were being copied; otherwise the copy is redone from the new
+ * tail. Caller holds reader->lock.
+ */
+static ssize_t adxl345_ring_pop_user(struct adxl345_reader *reader, char __user *ubuf, unsigned int max)
+{
+    struct adxl345_ring *ring = &reader->adxl345->ring;
+    struct adxl345_sample __user *usample = (struct adxl345_sample __user *)ubuf;
+    unsigned int skips, tail, count, start, first;
+    u16 flags;
+
+    do {
+        // skips before tail: a skip seen here is already reflected in tail
+        skips = smp_load_acquire(&reader->skips);
+        tail = READ_ONCE(reader->tail);
+        count = min3(smp_load_acquire(&ring->ctrl->head) - tail, ring->size, max);
+        start = tail & (ring->size - 1);
+        first = min(count, ring->size - start);
+
+        if (copy_to_user(ubuf, &ring->samples[start], first * sizeof(struct adxl345_sample)))
+            return -EFAULT;
+        if (copy_to_user(ubuf + first * sizeof(struct adxl345_sample), ring->samples,
+                         (count - first) * sizeof(struct adxl345_sample)))
+            return -EFAULT;
+    } while (cmpxchg(&reader->tail, tail, tail + count) != tail);
+
+    // Samples were skipped since the last read: say so on the first one
+    if (count && skips != reader->seen_skips) {
+        reader->seen_skips = skips;
+        if (get_user(flags, &usample->flags) ||
+            put_user(flags | ADXL345_SAMPLE_OVERRUN, &usample->flags))
+            return -EFAULT;
+    }
+    return count * sizeof(struct adxl345_sample);
+}
+
+// First read(), or poll() on an unmapped file: follow the stream from its newest sample on
+static void adxl345_reader_attach(struct adxl345_reader *reader)
+{
+    struct adxl345_data *adxl345 = reader->adxl345;
+
+    spin_lock_irq(&adxl345->readers_lock);
+    if (!reader->attached) {
+        reader->tail = adxl345->ring.ctrl->head;
+        reader->seen_skips = reader->skips;
+        list_add_tail(&reader->entry, &adxl345->readers);
+        WRITE_ONCE(reader->attached, true);
+    }
+    spin_unlock_irq(&adxl345->readers_lock);
+}
+
+// The shared tail becomes a cursor again (first mapping, group): start it at the newest sample
+static void adxl345_ring_share(struct adxl345_data *adxl345)
+{
+    spin_lock_irq(&adxl345->readers_lock);
+    WRITE_ONCE(adxl345->ring.ctrl->tail, adxl345->ring.ctrl->head);
+    spin_unlock_irq(&adxl345->readers_lock);
+}
+
+// Read all three axes in a single burst so they belong to the same instant
+static int adxl345_read_sample(struct adxl345_data *adxl345, struct adxl345_sample *sample)
+{
+    int ret;
+
+    ret = pm_runtime_resume_and_get(adxl345->dev);
+    if(ret < 0)
+        return ret;
+    mutex_lock(&adxl345->buf_lock);
+    ret = adxl345_read_regs(adxl345, ADXL345_REG_DATAX0, adxl345->sample_raw,
+                            sizeof(adxl345->sample_raw));
+    if(ret == 0)
+        adxl345_decode(adxl345->sample_raw, sample);
+    mutex_unlock(&adxl345->buf_lock);
+    pm_runtime_mark_last_busy(adxl345->dev);
+    pm_runtime_put_autosuspend(adxl345->dev);
+    if(ret < 0){
+        dev_info(adxl345->dev, "Failed to read accelerometer data!!!\n");
+        return -EIO;
+    }
+
+    sample->timestamp_ns = adxl345_core_timestamp(adxl345);
+    return 0;
+}
+
+// Legacy single-axis read in whole m/s^2, rounded to nearest
+static int adxl345_read_data(struct adxl345_data *adxl345, int axis, int *data)
+{
+    struct adxl345_sample sample;
+    s16 accel_data[3];
+    int ret;
+
+    ret = adxl345_read_sample(adxl345, &sample);
+    if(ret < 0)
+        return ret;
+
+    accel_data[0] = sample.x;
+    accel_data[1] = sample.y;
+    accel_data[2] = sample.z;
+
+    *data = ((s32)accel_data[axis] * (s32)READ_ONCE(adxl345->scale)->ms2_q16 + (1 << 15)) >> 16;
+    return 0;
+}
+
+static void adxl345_iio_push(struct adxl345_data *adxl345, const u8 *raw, unsigned int entries,
+                             s64 newest, u64 period_q16)
+{
+    struct adxl345_scan *scan = &adxl345->scan;
+    unsigned int i;
+
+    if(!adxl345->indio_dev || !iio_buffer_enabled(adxl345->indio_dev))
+        return;
+
+    for(i = 0; i < entries; i++){
+        memcpy(scan->channels, &raw[i * ADXL345_SAMPLE_SIZE], ADXL345_SAMPLE_SIZE);
+        iio_push_to_buffers_with_timestamp(adxl345->indio_dev, scan,
+                                           adxl345_sample_time(newest, period_q16, entries - 1 - i));
+    }
+}
+
+s64 adxl345_core_timestamp(struct adxl345_data *adxl345)
+{
+    return READ_ONCE(adxl345->boottime) ? ktime_get_boottime_ns() : ktime_get_ns();
+}
+EXPORT_SYMBOL_GPL(adxl345_core_timestamp);
+
+// BW_RATE code 0x0F is 3200 Hz and every step down halves it
+static u64 adxl345_rate_to_uhz(unsigned int code)
+{
+    return (3200ULL * 1000000) >> (ADXL345_BW_RATE_MAX - code);
+}
+
+// Forget the stream history; called while no producer runs
+static void adxl345_timing_reset(struct adxl345_data *adxl345)
+{
+    struct adxl345_timing *timing = &adxl345->timing;
+
+    // 312.5 us at 3200 Hz, doubling with every lower BW_RATE code
+    timing->nominal_q16 = (312500ULL << 16) <<
+                          (ADXL345_BW_RATE_MAX - (adxl345->bw_rate & ADXL345_BW_RATE_MASK));
+    timing->period_q16 = timing->nominal_q16;
+    timing->valid = false;
+}
+
+/*
+ * Place the newest entry of a batch. The samples drained since the last
+ * IRQ span the time between the two IRQs, which gives one noisy period
+ * measurement per batch; it is bounded to +-1/16 of nominal and low-pass
+ * filtered. The batch then continues from the previous one at the
+ * estimated period, pulled gently towards the IRQ time and never past it.
+ * After a gap (overrun, restart) the batch is simply anchored at the IRQ.
+ */
+static s64 adxl345_timing_update(struct adxl345_timing *timing, unsigned int entries,
+                                 s64 irq_time, bool gap)
+{
+    u64 meas, lo, hi;
+    s64 predicted, err, newest;
+
+    if (!timing->valid || gap || irq_time <= timing->last_irq) {
+        newest = irq_time;
+        goto out;
+    }
+
+    meas = div_u64((u64)(irq_time - timing->last_irq) << 16, entries);
+    lo = timing->nominal_q16 - (timing->nominal_q16 >> ADXL345_TIMING_TOLERANCE_SHIFT);
+    hi = timing->nominal_q16 + (timing->nominal_q16 >> ADXL345_TIMING_TOLERANCE_SHIFT);
+    meas = clamp(meas, lo, hi);
+    timing->period_q16 += ((s64)(meas - timing->period_q16)) >> ADXL345_TIMING_FILTER_SHIFT;
+
+    predicted = timing->last_ts + (s64)((entries * timing->period_q16) >> 16);
+    err = irq_time - predicted;
+    newest = err < 0 ? irq_time : predicted + (err >> ADXL345_TIMING_PHASE_SHIFT);
+out:
+    timing->last_irq = irq_time;
+    timing->last_ts = newest;
+    timing->valid = true;
+    return newest;
+}
+
+static void adxl345_decim_reset(struct adxl345_decimator *decim)
+{
+    decim->phase = 0;
+    memset(decim->integ, 0, sizeof(decim->integ));
+    memset(decim->comb, 0, sizeof(decim->comb));
+}
+
+/*
+ * Filter a batch into decim->raw. Returns the number of outputs and sets
+ * *back to how many inputs precede the end of the batch after the last one.
+ */
+static unsigned int adxl345_decimate(struct adxl345_decimator *decim, const u8 *raw,
+                                     unsigned int entries, unsigned int *back)
+{
+    unsigned int i, axis, stage, out = 0;
+    const u8 *in;
+    u8 *dst;
+    u64 v, prev;
+    s16 y;
+
+    for (i = 0; i < entries; i++) {
+        in = &raw[i * ADXL345_SAMPLE_SIZE];
+        for (axis = 0; axis < 3; axis++) {
+            v = (u64)(s64)(s16)get_unaligned_le16(&in[axis * 2]);
+            for (stage = 0; stage < decim->order; stage++)
+                v = decim->integ[stage][axis] += v;
+        }
+        if (++decim->phase < (1U << decim->shift))
+            continue;
+
+        // Combs run at the output rate; the gain is 2^(order * shift)
+        decim->phase = 0;
+        dst = &decim->raw[out * ADXL345_SAMPLE_SIZE];
+        for (axis = 0; axis < 3; axis++) {
+            v = decim->integ[decim->order - 1][axis];
+            for (stage = 0; stage < decim->order; stage++) {
+                prev = decim->comb[stage][axis];
+                decim->comb[stage][axis] = v;
+                v -= prev;
+            }
+            y = (s64)v >> (decim->order * decim->shift);
+            put_unaligned_le16(y, &dst[axis * 2]);
+        }
+        out++;
+        *back = entries - 1 - i;
+    }
+    return out;
+}
+
+// log2 histogram bucket of a latency: 0 below 1 us, n for [2^(n-1), 2^n) us
+static unsigned int adxl345_latency_bucket(s64 latency)
+{
+    u64 us = latency > 0 ? div_u64(latency, NSEC_PER_USEC) : 0;
+
+    return us ? min_t(unsigned int, ilog2(us) + 1, ADXL345_LATENCY_BUCKETS - 1) : 0;
+}
+
+// Latency from the IRQ or poll timer, or the READ_FIFO call, to the drained batch reaching the core
+static void adxl345_account_drain(struct adxl345_data *adxl345, unsigned int entries,
+                                  s64 timestamp, bool overrun)
+{
+    struct adxl345_stats *stats = &adxl345->stats;
+    s64 latency = adxl345_core_timestamp(adxl345) - timestamp;
+    unsigned int bucket = adxl345_latency_bucket(latency);
+
+    WRITE_ONCE(stats->samples, stats->samples + entries);
+    if(overrun)
+        WRITE_ONCE(stats->fifo_overruns, stats->fifo_overruns + 1);
+    WRITE_ONCE(stats->irq_latency[bucket], stats->irq_latency[bucket] + 1);
+    trace_adxl345_fifo_drain(adxl345->dev, entries, overrun,
+                             min(adxl345->ring.backlog, adxl345->ring.size),
+                             max_t(s64, latency, 0));
+}
+
+void adxl345_core_push(struct adxl345_data *adxl345, const u8 *raw, unsigned int entries,
+                       s64 timestamp, bool overrun)
+{
+    struct adxl345_timing *timing = &adxl345->timing;
+    struct adxl345_decimator *decim = &adxl345->decim;
+    unsigned int back;
+    u64 period_q16;
+    s64 newest;
+
+    adxl345_account_drain(adxl345, entries, timestamp, overrun);
+    if(overrun)
+        adxl345->ring.lost = true;
+    newest = adxl345_timing_update(timing, entries, timestamp, overrun);
+    period_q16 = timing->period_q16;
+    adxl345_iio_push(adxl345, raw, entries, newest, period_q16);
+
+    if(decim->shift){
+        entries = adxl345_decimate(decim, raw, entries, &back);
+        // Stamp each output at the centre of its window, the filter's group delay
+        if(entries)
+            newest = adxl345_sample_time(newest, period_q16, back) -
+                     (s64)((decim->order * ((1ULL << decim->shift) - 1) * period_q16) >> 17);
+        period_q16 <<= decim->shift;
+        raw = decim->raw;
+    }
+    if(entries)
+        adxl345_ring_push(adxl345, raw, entries, newest, period_q16);
+
+    if(adxl345->ring.backlog >= READ_ONCE(adxl345->wakeup))
+        wake_up_interruptible(&adxl345->wait);
+    if(READ_ONCE(adxl345->group))
+        wake_up_interruptible(&group_wait);
+}
+EXPORT_SYMBOL_GPL(adxl345_core_push);
+
+void adxl345_core_drain_done(struct adxl345_data *adxl345)
+{
+    enable_irq(adxl345->irq);
+}
+EXPORT_SYMBOL_GPL(adxl345_core_drain_done);
+
+void adxl345_core_bus_error(struct adxl345_data *adxl345, int err)
+{
+    atomic64_inc(&adxl345->stats.bus_errors);
+    dev_err_ratelimited(adxl345->dev, "FIFO transfer failed: %d\n", err);
+}
+EXPORT_SYMBOL_GPL(adxl345_core_bus_error);
+
+static void adxl345_devres_release(struct device *dev, void *res)
+{
+}
+
+// NULL until the core probe has finished and again once remove has started
+static struct adxl345_data *adxl345_from_dev(struct device *dev)
+{
+    struct adxl345_data **res = devres_find(dev, adxl345_devres_release, NULL, NULL);
+
+    return res ? *res : NULL;
+}
+
+static int adxl345_runtime_suspend(struct device *dev)
+{
+    struct adxl345_data *adxl345 = adxl345_from_dev(dev);
+
+    if (!adxl345)
+        return 0;
+    return regmap_clear_bits(adxl345->regmap, ADXL345_REG_PWR_CTL, ADXL345_PWR_CTL_MEASURE);
+}
+
+static int adxl345_runtime_resume(struct device *dev)
+{
+    struct adxl345_data *adxl345 = adxl345_from_dev(dev);
+    unsigned int code;
+    int ret;
+
+    if (!adxl345)
+        return 0;
+    ret = regmap_set_bits(adxl345->regmap, ADXL345_REG_PWR_CTL, ADXL345_PWR_CTL_MEASURE);
+    if (ret < 0)
+        return ret;
+
+    // First conversion is ready after one output period plus 1.1 ms; cap the wait at 20 ms
+    code = adxl345->bw_rate & ADXL345_BW_RATE_MASK;
+    fsleep(min_t(u64, ((625ULL << (ADXL345_BW_RATE_MAX - code)) >> 1) + 1100, 20000));
+    return 0;
+}
+
+/*
+ * The sensor may lose power across system sleep: keep register writes in
+ * the cache meanwhile and replay them before measurement restarts.
+ */
+static int adxl345_suspend(struct device *dev)
+{
+    struct adxl345_data *adxl345 = adxl345_from_dev(dev);
+    int ret;
+
+    // The IRQ is suspended by the core; a poll timer and its drain have to be stopped here
+    if (adxl345 && adxl345->irq <= 0) {
+        hrtimer_cancel(&adxl345->acq_timer);
+        kthread_flush_work(&adxl345->acq_work);
+    }
+    ret = pm_runtime_force_suspend(dev);
+    if (ret < 0 || !adxl345)
+        return ret;
+    regcache_cache_only(adxl345->regmap, true);
+    regcache_mark_dirty(adxl345->regmap);
+    return 0;
+}
+
+static int adxl345_resume(struct device *dev)
+{
+    struct adxl345_data *adxl345 = adxl345_from_dev(dev);
+    int ret;
+
+    if (adxl345) {
+        regcache_cache_only(adxl345->regmap, false);
+        ret = regcache_sync(adxl345->regmap);
+        if (ret < 0)
+            return ret;
+    }
+    ret = pm_runtime_force_resume(dev);
+    if (ret == 0 && adxl345 && adxl345->irq <= 0 && READ_ONCE(adxl345->streaming))
+        hrtimer_start(&adxl345->acq_timer, adxl345->acq_interval, HRTIMER_MODE_REL);
+    return ret;
+}
+
+EXPORT_GPL_DEV_PM_OPS(adxl345_pm_ops) = {
+    SYSTEM_SLEEP_PM_OPS(adxl345_suspend, adxl345_resume)
+    RUNTIME_PM_OPS(adxl345_runtime_suspend, adxl345_runtime_resume, NULL)
+};
+
+// Queue one event per detection bit; INT_SOURCE has already been cleared by reading it
+static void adxl345_queue_events(struct adxl345_data *adxl345, u8 status, s64 timestamp)
+{
+    struct adxl345_event event = { .timestamp_ns = timestamp };
+    int act_tap = 0;
+    u8 bit;
+
+    if(status & (ADXL345_EVENT_ACTIVITY | ADXL345_EVENT_SINGLE_TAP | ADXL345_EVENT_DOUBLE_TAP))
+        act_tap = adxl345_read_reg(adxl345, ADXL345_REG_ACT_TAP_STATUS);
+
+    for(bit = ADXL345_EVENT_SINGLE_TAP; bit >= ADXL345_EVENT_FREE_FALL; bit >>= 1){
+        if(!(status & bit))
+            continue;
+        event.type = bit;
+        if(act_tap < 0)
+            event.axes = 0;
+        else if(bit == ADXL345_EVENT_ACTIVITY)
+            event.axes = (act_tap >> 4) & 0x7;
+        else if(bit & (ADXL345_EVENT_SINGLE_TAP | ADXL345_EVENT_DOUBLE_TAP))
+            event.axes = act_tap & 0x7;
+        else
+            event.axes = 0;
+        // The acquisition thread and READ_FIFO both read INT_SOURCE, so both produce
+        spin_lock_irq(&adxl345->event_lock);
+        if(!kfifo_put(&adxl345->events, event))
+            adxl345->events_lost++;
+        spin_unlock_irq(&adxl345->event_lock);
+    }
+    wake_up_interruptible(&adxl345->wait);
+}
+
+/*
+ * Stamp the wake-up and mask the line until the drain is done. The
+ * transport drains on its own when it can do so asynchronously and no
+ * detection engine needs INT_SOURCE looked at; anything else goes to the
+ * acquisition thread.
+ */
+static irqreturn_t adxl345_irq(int irq, void *dev_id)
+{
+    struct adxl345_data *adxl345 = dev_id;
+    s64 timestamp = adxl345_core_timestamp(adxl345);
+
+    disable_irq_nosync(irq);
+    if(adxl345->ops->drain_async && !(READ_ONCE(adxl345->int_enable) & ADXL345_INT_EVENTS)){
+        if(adxl345->ops->drain_async(adxl345->bus, watermark, timestamp) < 0){
+            atomic64_inc(&adxl345->stats.retries);
+            enable_irq(irq);
+        }
+        return IRQ_HANDLED;
+    }
+    WRITE_ONCE(adxl345->acq_wake, timestamp);
+    kthread_queue_work(adxl345->acq_worker, &adxl345->acq_work);
+    return IRQ_HANDLED;
+}
+
+// No IRQ line: look at the FIFO every time a watermark's worth of samples is due
+static enum hrtimer_restart adxl345_acq_tick(struct hrtimer *timer)
+{
+    struct adxl345_data *adxl345 = container_of(timer, struct adxl345_data, acq_timer);
+
+    WRITE_ONCE(adxl345->acq_wake, adxl345_core_timestamp(adxl345));
+    kthread_queue_work(adxl345->acq_worker, &adxl345->acq_work);
+    hrtimer_forward_now(timer, adxl345->acq_interval);
+    return HRTIMER_RESTART;
+}
+
+/*
+ * Read INT_SOURCE and route the detection bits it reports, since reading
+ * it clears them. Returns the raw status: it reports every engine,
+ * enabled or not.
+ */
+static int adxl345_int_source(struct adxl345_data *adxl345, s64 timestamp)
+{
+    int status, enabled;
+
+    status = adxl345_read_reg(adxl345, ADXL345_REG_INT_SOURCE);
+    if(status < 0)
+        return status;
+    enabled = status & READ_ONCE(adxl345->int_enable);
+    if(enabled & READ_ONCE(adxl345->event_mask))
+        adxl345_queue_events(adxl345, enabled & adxl345->event_mask, timestamp);
+    if(READ_ONCE(adxl345->autosleep) && (enabled & (ADXL345_EVENT_ACTIVITY | ADXL345_EVENT_INACTIVITY))){
+        // The rate change pauses the stream, which cannot be done from this thread
+        WRITE_ONCE(adxl345->want_sleep, !!(enabled & ADXL345_EVENT_INACTIVITY));
+        schedule_work(&adxl345->sleep_work);
+    }
+    return status;
+}
+
+// Handle INT_SOURCE and drain the FIFO; timestamp is when the IRQ or timer fired
+static void adxl345_acquire(struct adxl345_data *adxl345, s64 timestamp)
+{
+    int status, entries;
+
+    status = adxl345_int_source(adxl345, timestamp);
+    if(status < 0)
+        return;
+    status &= READ_ONCE(adxl345->int_enable);
+    /*
+     * Polled, a tick can come a sample early against a slow oscillator and
+     * miss the watermark; waiting for the next one would overrun the FIFO,
+     * so drain whatever is there.
+     */
+    if(adxl345->irq > 0 && !(status & (ADXL345_INT_WATERMARK | ADXL345_INT_OVERRUN)))
+        return;
+
+    entries = adxl345_read_reg(adxl345, ADXL345_REG_FIFO_STATUS);
+    if(entries < 0)
+        return;
+    entries = min(ADXL345_FIFO_ENTRIES(entries), ADXL345_FIFO_DEPTH);
+    if(entries == 0)
+        return;
+
+    if(adxl345_burst_read(adxl345, adxl345->fifo_raw, entries) < 0){
+        dev_err_ratelimited(adxl345->dev, "Failed to drain accelerometer FIFO\n");
+        return;
+    }
+    adxl345_core_push(adxl345, adxl345->fifo_raw, entries, timestamp,
+                      status & ADXL345_INT_OVERRUN);
+}
+
+static void adxl345_acq_work(struct kthread_work *work)
+{
+    struct adxl345_data *adxl345 = container_of(work, struct adxl345_data, acq_work);
+    struct adxl345_stats *stats = &adxl345->stats;
+    s64 wake = READ_ONCE(adxl345->acq_wake);
+    unsigned int bucket = adxl345_latency_bucket(adxl345_core_timestamp(adxl345) - wake);
+
+    WRITE_ONCE(stats->wake_latency[bucket], stats->wake_latency[bucket] + 1);
+    adxl345_acquire(adxl345, wake);
+    if(adxl345->irq > 0)
+        enable_irq(adxl345->irq);
+}
+
+// Apply acq_cpu and acq_priority to the acquisition thread; caller holds lock
+static int adxl345_acq_apply(struct adxl345_data *adxl345)
+{
+    struct task_struct *task = adxl345->acq_worker->task;
+    struct sched_attr attr = {
+        .size = sizeof(attr),
+        .sched_policy = adxl345->acq_priority ? SCHED_FIFO : SCHED_NORMAL,
+        .sched_priority = adxl345->acq_priority,
+    };
+    int ret;
+
+    ret = set_cpus_allowed_ptr(task, adxl345->acq_cpu < 0 ? cpu_possible_mask :
+                                     cpumask_of(adxl345->acq_cpu));
+    if(ret < 0)
+        return ret;
+    return sched_setattr_nocheck(task, &attr);
+}
+
+// Detection engines routed to the IRQ: the user's plus the ones autosleep relies on
+static u8 adxl345_int_events(struct adxl345_data *adxl345)
+{
+    return adxl345->event_mask |
+           (adxl345->autosleep ? ADXL345_EVENT_ACTIVITY | ADXL345_EVENT_INACTIVITY : 0);
+}
+
+// Armed engines need the part measuring, so they hold a runtime PM reference
+static int adxl345_events_pm(struct adxl345_data *adxl345, u8 old, u8 new)
+{
+    if (!old && new)
+        return pm_runtime_resume_and_get(adxl345->dev);
+    if (old && !new) {
+        pm_runtime_mark_last_busy(adxl345->dev);
+        pm_runtime_put_autosuspend(adxl345->dev);
+    }
+    return 0;
+}
+
+// Put the FIFO in stream mode and raise INT1 on watermark/overrun
+static int adxl345_stream_start(struct adxl345_data *adxl345)
+{
+    // A restart after reconfiguration, or a polled FIFO, already holds the reference
+    bool held = adxl345->streaming || adxl345->fifo_polled;
+    int ret;
+
+    if(adxl345->removed)
+        return -ENODEV;
+    if(!held){
+        ret = pm_runtime_resume_and_get(adxl345->dev);
+        if(ret < 0)
+            return ret;
+    }
+    adxl345_timing_reset(adxl345);
+    adxl345_decim_reset(&adxl345->decim);
+    ret = adxl345_write_reg(adxl345, ADXL345_REG_FIFO_CTL, ADXL345_FIFO_STREAM | watermark);
+    if(ret == 0)
+        ret = adxl345_write_reg(adxl345, ADXL345_REG_INT_MAP, 0);
+    if(ret == 0)
+        ret = adxl345_write_reg(adxl345, ADXL345_REG_INT_ENABLE, adxl345_int_events(adxl345) |
+                                ADXL345_INT_WATERMARK | ADXL345_INT_OVERRUN);
+    if(ret < 0){
+        if(!held)
+            pm_runtime_put_autosuspend(adxl345->dev);
+        return ret;
+    }
+    if(adxl345->irq <= 0){
+        adxl345->acq_interval = ns_to_ktime((watermark * adxl345->timing.nominal_q16) >> 16);
+        hrtimer_start(&adxl345->acq_timer, adxl345->acq_interval, HRTIMER_MODE_REL);
+    }
+    // The stream takes the polled FIFO over, reference included
+    adxl345->fifo_polled = false;
+    adxl345->streaming = true;
+    return 0;
+}
+
+// Stop the FIFO and wait until no drain is running; the ring and event engines are left alone
+static void adxl345_stream_quiesce(struct adxl345_data *adxl345)
+{
+    adxl345_write_reg(adxl345, ADXL345_REG_INT_ENABLE, adxl345_int_events(adxl345));
+    adxl345_write_reg(adxl345, ADXL345_REG_FIFO_CTL, ADXL345_FIFO_BYPASS);
+    if (adxl345->irq > 0)
+        synchronize_irq(adxl345->irq);
+    else
+        hrtimer_cancel(&adxl345->acq_timer);
+    kthread_flush_work(&adxl345->acq_work);
+    if (adxl345->ops->drain_flush && adxl345->bus)
+        adxl345->ops->drain_flush(adxl345->bus);
+}
+
+static void adxl345_stream_stop(struct adxl345_data *adxl345)
+{
+    struct adxl345_ring *ring = &adxl345->ring;
+    struct adxl345_reader *reader;
+
+    adxl345_stream_quiesce(adxl345);
+    adxl345->streaming = false;
+    pm_runtime_mark_last_busy(adxl345->dev);
+    pm_runtime_put_autosuspend(adxl345->dev);
+
+    // No producer is running any more: drop whatever every cursor still had buffered
+    spin_lock_irq(&adxl345->readers_lock);
+    WRITE_ONCE(ring->ctrl->tail, ring->ctrl->head);
+    list_for_each_entry(reader, &adxl345->readers, entry)
+        WRITE_ONCE(reader->tail, ring->ctrl->head);
+    ring->lost = false;
+    ring->backlog = 0;
+    spin_unlock_irq(&adxl345->readers_lock);
+}
+
+// Stop a running stream around a reconfiguration; returns whether it was running
+static bool adxl345_stream_pause(struct adxl345_data *adxl345)
+{
+    if (!adxl345->streaming)
+        return false;
+    adxl345_stream_quiesce(adxl345);
+    adxl345->ring.lost = true;      // No producer runs until the restart
+    return true;
+}
+
+static int adxl345_stream_resume(struct adxl345_data *adxl345, bool paused)
+{
+    int ret;
+
+    if (!paused)
+        return 0;
+    ret = adxl345_stream_start(adxl345);
+    if (ret < 0)
+        dev_err(adxl345->dev, "Failed to restart FIFO stream: %d\n", ret);
+    return ret;
+}
+
+// Turn the polled FIFO off again; caller holds lock
+static void adxl345_fifo_poll_stop(struct adxl345_data *adxl345)
+{
+    if (!adxl345->fifo_polled)
+        return;
+    adxl345_write_reg(adxl345, ADXL345_REG_FIFO_CTL, ADXL345_FIFO_BYPASS);
+    adxl345->fifo_polled = false;
+    pm_runtime_mark_last_busy(adxl345->dev);
+    pm_runtime_put_autosuspend(adxl345->dev);
+}
+
+/*
+ * READ_FIFO: one INT_SOURCE and one FIFO_STATUS read, then one burst for
+ * everything buffered. Overflow is the sensor's own overrun bit: a full
+ * FIFO alone does not mean anything was lost. Timestamps follow the
+ * stream's timing model with the call as the batch's reference instant;
+ * a partial drain restarts it at the next call. Samples are decoded into
+ * the file's fifo_buf and copied out once adxl345->lock is dropped; the
+ * caller holds reader->lock.
+ */
+static int adxl345_fifo_poll(struct adxl345_reader *reader, struct adxl345_fifo_read *req)
+{
+    struct adxl345_data *adxl345 = reader->adxl345;
+    struct adxl345_sample *samples = reader->fifo_buf;
+    unsigned int i, avail, entries = 0;
+    bool overflow;
+    s64 timestamp, newest;
+    u64 period_q16;
+    int ret, status;
+
+    mutex_lock(&adxl345->lock);
+    if (adxl345->removed) {
+        ret = -ENODEV;
+        goto out;
+    }
+    if (adxl345->streaming) {
+        ret = -EBUSY;
+        goto out;
+    }
+    if (!adxl345->fifo_polled) {
+        ret = pm_runtime_resume_and_get(adxl345->dev);
+        if (ret < 0)
+            goto out;
+        adxl345_timing_reset(adxl345);
+        ret = adxl345_write_reg(adxl345, ADXL345_REG_FIFO_CTL, ADXL345_FIFO_STREAM | watermark);
+        if (ret < 0) {
+            pm_runtime_put_autosuspend(adxl345->dev);
+            goto out;
+        }
+        adxl345->fifo_polled = true;
+    }
+
+    timestamp = adxl345_core_timestamp(adxl345);
+    status = adxl345_int_source(adxl345, timestamp);
+    if (status < 0) {
+        ret = status;
+        goto out;
+    }
+    ret = adxl345_read_reg(adxl345, ADXL345_REG_FIFO_STATUS);
+    if (ret < 0)
+        goto out;
+    avail = min(ADXL345_FIFO_ENTRIES(ret), ADXL345_FIFO_DEPTH);
+    entries = min3(avail, req->max, (u32)ADXL345_FIFO_READ_MAX);
+    overflow = status & ADXL345_INT_OVERRUN;
+    req->count = 0;
+    req->flags = overflow ? ADXL345_FIFO_READ_OVERFLOW : 0;
+    req->pending = avail - entries;
+    ret = 0;
+    if (!entries)
+        goto out;
+
+    ret = adxl345_burst_read(adxl345, adxl345->fifo_raw, entries);
+    if (ret < 0) {
+        entries = 0;
+        goto out;
+    }
+    adxl345_account_drain(adxl345, entries, timestamp, overflow);
+    newest = adxl345_timing_update(&adxl345->timing, avail, timestamp, overflow);
+    period_q16 = adxl345->timing.period_q16;
+    if (entries < avail)
+        adxl345->timing.valid = false;
+
+    for (i = 0; i < entries; i++) {
+        adxl345_decode(&adxl345->fifo_raw[i * ADXL345_SAMPLE_SIZE], &samples[i]);
+        samples[i].timestamp_ns = adxl345_sample_time(newest, period_q16, avail - 1 - i);
+    }
+    if (overflow)
+        samples[0].flags |= ADXL345_SAMPLE_OVERRUN;
+out:
+    mutex_unlock(&adxl345->lock);
+    if (ret == 0 && entries) {
+        if (copy_to_user(u64_to_user_ptr(req->samples), samples, entries * sizeof(*samples)))
+            ret = -EFAULT;
+        else
+            req->count = entries;
+    }
+    return ret;
+}
+
+/*
+ * Read-modify-write DATA_FORMAT and BW_RATE. A running stream is paused
+ * around the change so the FIFO never mixes entries of two setups; the
+ * discarded FIFO contents show up as ADXL345_SAMPLE_OVERRUN on the next
+ * sample while readers and the ring stay in place.
+ */
+static int adxl345_update_config(struct adxl345_data *adxl345, u8 format_mask, u8 format,
+                                 u8 rate_mask, u8 rate)
+{
+    bool paused;
+    int ret, err;
+
+    mutex_lock(&adxl345->lock);
+    format = (adxl345->data_format & ~format_mask) | (format & format_mask);
+    rate = (adxl345->bw_rate & ~rate_mask) | (rate & rate_mask);
+    if (format == adxl345->data_format && rate == adxl345->bw_rate) {
+        mutex_unlock(&adxl345->lock);
+        return 0;
+    }
+
+    paused = adxl345_stream_pause(adxl345);
+    if (paused && rate != adxl345->bw_rate)
+        adxl345->ring.rate_changed = true;
+    ret = adxl345_write_reg(adxl345, ADXL345_REG_DATA_FORMAT, format);
+    if (ret == 0)
+        ret = adxl345_write_reg(adxl345, ADXL345_REG_BW_RATE, rate);
+    // A polled FIFO keeps running; re-anchor its timestamps at the next call
+    if (adxl345->fifo_polled)
+        adxl345_timing_reset(adxl345);
+    err = adxl345_stream_resume(adxl345, paused);
+    mutex_unlock(&adxl345->lock);
+    return ret ? ret : err;
+}
+
+static int adxl345_set_decimation(struct adxl345_data *adxl345,
+                                  const struct adxl345_decimation *config)
+{
+    bool paused;
+    int ret;
+
+    if (!is_power_of_2(config->ratio) || config->ratio > ADXL345_DECIMATION_MAX ||
+        config->order < 1 || config->order > ADXL345_CIC_MAX_ORDER)
+        return -EINVAL;
+
+    mutex_lock(&adxl345->lock);
+    paused = adxl345_stream_pause(adxl345);
+    adxl345->decim.shift = ilog2(config->ratio);
+    adxl345->decim.order = config->order;
+    ret = adxl345_stream_resume(adxl345, paused);
+    mutex_unlock(&adxl345->lock);
+    return ret;
+}
+
+// Convert to register steps of unit, saturating at the 8-bit maximum
+static u8 adxl345_event_steps(u32 value, u32 unit)
+{
+    return min_t(u32, DIV_ROUND_CLOSEST(value, unit), 0xFF);
+}
+
+/*
+ * Program the detection engines. The thresholds and timings go in with the
+ * engines disabled, then INT_ENABLE picks up the new set; streaming keeps
+ * running. Thresholds are in 62.5 mg steps, hence the doubled values.
+ */
+static int adxl345_set_events(struct adxl345_data *adxl345, const struct adxl345_event_config *config)
+{
+    const struct { u8 reg; u8 val; } regs[] = {
+        { ADXL345_REG_THRESH_ACT, adxl345_event_steps(config->act_thresh_mg * 2, 125) },
+        { ADXL345_REG_THRESH_INACT, adxl345_event_steps(config->inact_thresh_mg * 2, 125) },
+        { ADXL345_REG_TIME_INACT, min_t(u32, config->inact_time_s, 0xFF) },
+        { ADXL345_REG_THRESH_FF, adxl345_event_steps(config->ff_thresh_mg * 2, 125) },
+        { ADXL345_REG_TIME_FF, adxl345_event_steps(config->ff_time_ms, 5) },
+        { ADXL345_REG_THRESH_TAP, adxl345_event_steps(config->tap_thresh_mg * 2, 125) },
+        { ADXL345_REG_DUR, adxl345_event_steps(config->tap_dur_us, 625) },
+        { ADXL345_REG_LATENT, adxl345_event_steps(config->tap_latent_us, 1250) },
+        { ADXL345_REG_WINDOW, adxl345_event_steps(config->tap_window_us, 1250) },
+        { ADXL345_REG_ACT_INACT_CTL,
+          (config->flags & ADXL345_EVENT_CFG_AC_ACTIVITY ? ADXL345_ACT_AC : 0) |
+          (config->flags & ADXL345_EVENT_CFG_AC_INACTIVITY ? ADXL345_INACT_AC : 0) |
+          config->act_axes << 4 | config->act_axes },
+        { ADXL345_REG_TAP_AXES,
+          (config->flags & ADXL345_EVENT_CFG_TAP_SUPPRESS ? ADXL345_TAP_SUPPRESS : 0) |
+          config->tap_axes },
+    };
+    u8 enable, old;
+    unsigned int i;
+    int ret;
+
+    if (adxl345->irq <= 0)
+        return -EOPNOTSUPP;
+    if (config->enable & ~ADXL345_EVENT_ALL || config->act_axes > 0x7 || config->tap_axes > 0x7 ||
+        config->flags & ~(ADXL345_EVENT_CFG_AC_ACTIVITY | ADXL345_EVENT_CFG_AC_INACTIVITY |
+                          ADXL345_EVENT_CFG_TAP_SUPPRESS))
+        return -EINVAL;
+
+    mutex_lock(&adxl345->lock);
+    old = adxl345_int_events(adxl345);
+    enable = adxl345->int_enable & ~ADXL345_INT_EVENTS;
+    ret = adxl345_write_reg(adxl345, ADXL345_REG_INT_ENABLE, enable);
+    for (i = 0; i < ARRAY_SIZE(regs) && ret == 0; i++)
+        ret = adxl345_write_reg(adxl345, regs[i].reg, regs[i].val);
+    if (ret == 0) {
+        WRITE_ONCE(adxl345->event_mask, config->enable);
+        adxl345->event_config = *config;
+        ret = adxl345_events_pm(adxl345, old, adxl345_int_events(adxl345));
+    }
+    if (ret == 0)
+        ret = adxl345_write_reg(adxl345, ADXL345_REG_INT_ENABLE, enable | adxl345_int_events(adxl345));
+    mutex_unlock(&adxl345->lock);
+    return ret;
+}
+
+static void adxl345_sleep_work(struct work_struct *work)
+{
+    struct adxl345_data *adxl345 = container_of(work, struct adxl345_data, sleep_work);
+    bool sleep = READ_ONCE(adxl345->want_sleep) && READ_ONCE(adxl345->autosleep);
+    u8 mask = ADXL345_BW_RATE_MASK | ADXL345_BW_RATE_LOW_POWER;
+
+    if (sleep == adxl345->asleep)
+        return;
+    if (sleep) {
+        adxl345->awake_rate = READ_ONCE(adxl345->bw_rate) & mask;
+        if (adxl345_update_config(adxl345, 0, 0, mask,
+                                  (sleep_rate & ADXL345_BW_RATE_MASK) | ADXL345_BW_RATE_LOW_POWER))
+            return;
+    } else if (adxl345_update_config(adxl345, 0, 0, mask, adxl345->awake_rate)) {
+        return;
+    }
+    adxl345->asleep = sleep;
+    dev_dbg(adxl345->dev, "autosleep: %s\n", sleep ? "inactive, low-power rate" : "active");
+}
+
+/*
+ * Autosleep uses the activity/inactivity thresholds from SET_EVENTS, linked
+ * so the two alternate, whether or not those events are reported.
+ */
+static int adxl345_set_autosleep(struct adxl345_data *adxl345, bool on)
+{
+    const struct adxl345_event_config *config = &adxl345->event_config;
+    u8 old;
+    int ret;
+
+    if (adxl345->irq <= 0)
+        return -EOPNOTSUPP;
+
+    mutex_lock(&adxl345->lock);
+    if (on == adxl345->autosleep) {
+        mutex_unlock(&adxl345->lock);
+        return 0;
+    }
+    if (on && (!config->act_thresh_mg || !config->inact_thresh_mg || !config->act_axes)) {
+        mutex_unlock(&adxl345->lock);
+        return -EINVAL;
+    }
+
+    old = adxl345_int_events(adxl345);
+    ret = regmap_update_bits(adxl345->regmap, ADXL345_REG_PWR_CTL, ADXL345_PWR_CTL_LINK,
+                             on ? ADXL345_PWR_CTL_LINK : 0);
+    if (ret == 0) {
+        WRITE_ONCE(adxl345->want_sleep, false);
+        WRITE_ONCE(adxl345->autosleep, on);
+        ret = adxl345_events_pm(adxl345, old, adxl345_int_events(adxl345));
+    }
+    if (ret == 0)
+        ret = adxl345_write_reg(adxl345, ADXL345_REG_INT_ENABLE,
+                                (adxl345->int_enable & ~ADXL345_INT_EVENTS) | adxl345_int_events(adxl345));
+    mutex_unlock(&adxl345->lock);
+
+    // Leaving autosleep while asleep restores the full rate
+    if (!on) {
+        cancel_work_sync(&adxl345->sleep_work);
+        adxl345_sleep_work(&adxl345->sleep_work);
+    }
+    return ret;
+}
+
+// Dequeue one event, waiting for it unless O_NONBLOCK
+static int adxl345_read_event(struct adxl345_data *adxl345, struct file *filp,
+                              struct adxl345_event *event)
+{
+    while (!kfifo_out_spinlocked(&adxl345->events, event, 1, &adxl345->event_lock)) {
+        if (filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(adxl345->wait, !kfifo_is_empty(&adxl345->events) ||
+                                     !READ_ONCE(adxl345->bus)))
+            return -ERESTARTSYS;
+        if (!READ_ONCE(adxl345->bus))
+            return -ENODEV;
+    }
+    return 0;
+}
+
+static const unsigned int adxl345_ranges_g[] = { 2, 4, 8, 16 };
+
+static int adxl345_range_code(unsigned int g)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(adxl345_ranges_g); i++)
+        if (adxl345_ranges_g[i] == g)
+            return i;
+    return -EINVAL;
+}
+
+static int adxl345_set_config(struct adxl345_data *adxl345, const struct adxl345_config *config)
+{
+    int range = adxl345_range_code(config->range_g);
+    u8 format, rate;
+
+    if (range < 0 || config->rate > ADXL345_BW_RATE_MAX ||
+        config->flags & ~(ADXL345_CONFIG_FULL_RES | ADXL345_CONFIG_LOW_POWER))
+        return -EINVAL;
+
+    format = range;
+    if (config->flags & ADXL345_CONFIG_FULL_RES)
+        format |= ADXL345_DATA_FORMAT_FULL_RES;
+    rate = config->rate;
+    if (config->flags & ADXL345_CONFIG_LOW_POWER)
+        rate |= ADXL345_BW_RATE_LOW_POWER;
+
+    return adxl345_update_config(adxl345,
+                                 ADXL345_DATA_FORMAT_RANGE | ADXL345_DATA_FORMAT_FULL_RES, format,
+                                 ADXL345_BW_RATE_MASK | ADXL345_BW_RATE_LOW_POWER, rate);
+}
+
+static void adxl345_get_config(struct adxl345_data *adxl345, struct adxl345_config *config)
+{
+    u8 format = READ_ONCE(adxl345->data_format);
+    u8 rate = READ_ONCE(adxl345->bw_rate);
+
+    config->range_g = adxl345_ranges_g[format & ADXL345_DATA_FORMAT_RANGE];
+    config->rate = rate & ADXL345_BW_RATE_MASK;
+    config->flags = 0;
+    if (format & ADXL345_DATA_FORMAT_FULL_RES)
+        config->flags |= ADXL345_CONFIG_FULL_RES;
+    if (rate & ADXL345_BW_RATE_LOW_POWER)
+        config->flags |= ADXL345_CONFIG_LOW_POWER;
+}
+
+static void adxl345_free(struct adxl345_data *adxl345)
+{
+    adxl345_ring_free(&adxl345->ring);
+    regmap_exit(adxl345->regmap);
+    put_device(adxl345->dev);
+    kfree(adxl345);
+}
+
+static const struct file_operations adxl345_group_fops;
+
+// Open function: every open file gets its own reader cursor and output format
+static int adxl345_open(struct inode *inode, struct file *filp)
+{
+    struct adxl345_data *adxl345;
+    struct adxl345_reader *reader;
+    int status = -ENXIO;
+
+    if (iminor(inode) == ADXL345_GROUP_MINOR) {
+        replace_fops(filp, &adxl345_group_fops);
+        return filp->f_op->open(inode, filp);
+    }
+
+    reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+    if (!reader)
+        return -ENOMEM;
+    mutex_init(&reader->lock);
+    INIT_LIST_HEAD(&reader->entry);
+    reader->packer.anchor_interval = ADXL345_ANCHOR_INTERVAL_DEFAULT;
+    reader->packer.need_anchor = true;
+
+    mutex_lock(&device_list_lock);
+
+    list_for_each_entry(adxl345, &device_list, device_entry) 
+    {
+        if (adxl345->devt == inode->i_rdev) 
+        {
+            adxl345->users++;
+            reader->adxl345 = adxl345;
+            filp->private_data = reader;
+            nonseekable_open(inode, filp);
+            status = 0;
+            break;
+        }
+    }
+    mutex_unlock(&device_list_lock);
+
+    if (status < 0)
+        kfree(reader);
+    return status;
+}
+
+// Drop a reference taken by open() or by a group; call with device_list_lock held
+static void adxl345_put(struct adxl345_data *adxl345)
+{
+    mutex_lock(&adxl345->lock);
+    if(--adxl345->users == 0 && adxl345->streaming && !adxl345->iio_active)
+        adxl345_stream_stop(adxl345);
+    if(adxl345->users == 0)
+        adxl345_fifo_poll_stop(adxl345);
+    mutex_unlock(&adxl345->lock);
+
+    // The transport went away while this file was open
+    if (adxl345->users == 0 && !adxl345->bus)
+        adxl345_free(adxl345);
+}
+
+// Release function
+static int adxl345_release(struct inode *inode, struct file *filp)
+{
+    struct adxl345_reader *reader = filp->private_data;
+    struct adxl345_data *adxl345 = reader->adxl345;
+
+    // Stop holding the producer back before the device can go away
+    spin_lock_irq(&adxl345->readers_lock);
+    list_del(&reader->entry);
+    spin_unlock_irq(&adxl345->readers_lock);
+
+    mutex_lock(&device_list_lock);
+    adxl345_put(adxl345);
+    mutex_unlock(&device_list_lock);
+
+    kfree(reader);
+    return 0;
+}
+
+// Streaming is started lazily by the first read() or mmap()
+static int adxl345_stream_get(struct adxl345_data *adxl345)
+{
+    int ret;
+
+    mutex_lock(&adxl345->lock);
+    ret = adxl345->streaming ? 0 : adxl345_stream_start(adxl345);
+    mutex_unlock(&adxl345->lock);
+    return ret;
+}
+
+// Packed format: does the timeline need re-anchoring before this sample?
+static bool adxl345_anchor_due(const struct adxl345_packer *packer, const struct adxl345_sample *sample)
+{
+    s64 predicted;
+
+    if (packer->need_anchor || sample->flags)
+        return true;
+    if (packer->anchor_interval && packer->since_anchor >= packer->anchor_interval)
+        return true;
+    predicted = packer->anchor_ts + (s64)packer->since_anchor * packer->period_ns;
+    return abs(sample->timestamp_ns - predicted) > packer->period_ns / 4;
+}
+
+// Spacing after ring slot i: measured from its successor if that is in the same run, else nominal
+static u32 adxl345_anchor_period(struct adxl345_data *adxl345, unsigned int i, unsigned int count)
+{
+    struct adxl345_ring *ring = &adxl345->ring;
+    const struct adxl345_sample *sample = &ring->samples[i & (ring->size - 1)];
+    const struct adxl345_sample *next = &ring->samples[(i + 1) & (ring->size - 1)];
+    u64 uhz;
+
+    if (count > 1 && !next->flags && next->timestamp_ns > sample->timestamp_ns)
+        return min_t(s64, next->timestamp_ns - sample->timestamp_ns, U32_MAX);
+    uhz = adxl345_rate_to_uhz(READ_ONCE(adxl345->bw_rate) & ADXL345_BW_RATE_MASK);
+    return min_t(u64, div64_u64(1000000000000000ULL, uhz) << READ_ONCE(adxl345->decim.shift),
+                 U32_MAX);
+}
+
+/*
+ * Consumer side, packed format: encode records and anchors into pack_buf
+ * and copy them out a chunk at a time. Only whole records are returned;
+ * the packer state and tail move only once everything has been copied,
+ * and the whole pass is redone if the producer skipped this reader
+ * meanwhile. Caller holds reader->lock.
+ */
+static ssize_t adxl345_ring_pop_packed(struct adxl345_reader *reader, char __user *ubuf, size_t len)
+{
+    struct adxl345_data *adxl345 = reader->adxl345;
+    struct adxl345_ring *ring = &adxl345->ring;
+    struct adxl345_packer packer;
+    unsigned int skips, tail, count;
+    const struct adxl345_sample *sample;
+    struct adxl345_anchor *anchor;
+    struct adxl345_axes *axes;
+    size_t fill, done, need;
+    unsigned int i;
+    bool anchored, skipped;
+
+retry:
+    packer = reader->packer;
+    skips = smp_load_acquire(&reader->skips);
+    tail = READ_ONCE(reader->tail);
+    count = min(smp_load_acquire(&ring->ctrl->head) - tail, ring->size);
+    skipped = skips != reader->seen_skips;
+    fill = 0;
+    done = 0;
+
+    for (i = 0; i < count; i++) {
+        sample = &ring->samples[(tail + i) & (ring->size - 1)];
+        anchored = adxl345_anchor_due(&packer, sample) || (i == 0 && skipped);
+        need = sizeof(*axes) + (anchored ? sizeof(*anchor) : 0);
+        if (done + fill + need > len)
+            break;
+        if (fill + need > sizeof(reader->pack_buf)) {
+            if (copy_to_user(ubuf + done, reader->pack_buf, fill))
+                return -EFAULT;
+            done += fill;
+            fill = 0;
+        }
+
+        if (anchored) {
+            packer.anchor_ts = sample->timestamp_ns;
+            packer.period_ns = adxl345_anchor_period(adxl345, tail + i, count - i);
+            packer.since_anchor = 0;
+            packer.need_anchor = false;
+            anchor = (struct adxl345_anchor *)&reader->pack_buf[fill];
+            anchor->marker = ADXL345_PACKED_MARKER;
+            anchor->flags = sample->flags | (i == 0 && skipped ? ADXL345_SAMPLE_OVERRUN : 0);
+            anchor->period_ns = packer.period_ns;
+            anchor->timestamp_ns = sample->timestamp_ns;
+            anchor->reserved = 0;
+            fill += sizeof(*anchor);
+        }
+        axes = (struct adxl345_axes *)&reader->pack_buf[fill];
+        axes->x = sample->x;
+        axes->y = sample->y;
+        axes->z = sample->z;
+        fill += sizeof(*axes);
+        packer.since_anchor++;
+    }
+
+    if (fill && copy_to_user(ubuf + done, reader->pack_buf, fill))
+        return -EFAULT;
+    if (cmpxchg(&reader->tail, tail, tail + i) != tail)
+        goto retry;
+    reader->packer = packer;
+    if (i)
+        reader->seen_skips = skips;
+    return done + fill;
+}
+
+static int adxl345_set_format(struct adxl345_reader *reader, const struct adxl345_format *format)
+{
+    if (format->format != ADXL345_FORMAT_SAMPLE && format->format != ADXL345_FORMAT_PACKED)
+        return -EINVAL;
+
+    mutex_lock(&reader->lock);
+    WRITE_ONCE(reader->packer.format, format->format);
+    reader->packer.anchor_interval = format->anchor_interval;
+    reader->packer.need_anchor = true;
+    mutex_unlock(&reader->lock);
+    return 0;
+}
+
+static int adxl345_set_reader(struct adxl345_reader *reader, const struct adxl345_reader_config *config)
+{
+    struct adxl345_data *adxl345 = reader->adxl345;
+
+    if (config->policy > ADXL345_READER_DETACH)
+        return -EINVAL;
+
+    mutex_lock(&reader->lock);
+    spin_lock_irq(&adxl345->readers_lock);
+    reader->policy = config->policy;
+    // Setting a policy re-attaches a detached reader at the newest sample
+    if (reader->detached) {
+        reader->tail = adxl345->ring.ctrl->head;
+        reader->packer.need_anchor = true;
+        WRITE_ONCE(reader->detached, false);
+    }
+    spin_unlock_irq(&adxl345->readers_lock);
+    mutex_unlock(&reader->lock);
+    return 0;
+}
+
+// Blocking read of whole struct adxl345_sample records, or a packed stream
+static ssize_t adxl345_read(struct file *filp, char __user *ubuf, size_t len, loff_t *offset)
+{
+    struct adxl345_reader *reader = filp->private_data;
+    struct adxl345_data *adxl345 = reader->adxl345;
+    bool packed = READ_ONCE(reader->packer.format) == ADXL345_FORMAT_PACKED;
+    size_t record = packed ? sizeof(struct adxl345_axes) : sizeof(struct adxl345_sample);
+    unsigned int want;
+    ssize_t ret;
+
+    // Packed reads must at least fit an anchor and its sample
+    if(len < (packed ? sizeof(struct adxl345_anchor) + record : record))
+        return -EINVAL;
+    if(READ_ONCE(adxl345->group))
+        return -EBUSY;
+
+    ret = adxl345_stream_get(adxl345);
+    if(ret < 0)
+        return ret;
+    adxl345_reader_attach(reader);
+
+    // Block until a wake-up batch is buffered, or as much as fits in buf
+    want = min_t(size_t, READ_ONCE(adxl345->wakeup), len / record);
+    do {
+        if(filp->f_flags & O_NONBLOCK){
+            if(!adxl345_reader_count(reader) && !READ_ONCE(reader->detached))
+                return -EAGAIN;
+        } else if(wait_event_interruptible(adxl345->wait, adxl345_reader_count(reader) >= want ||
+                                           READ_ONCE(reader->detached) ||
+                                           !READ_ONCE(adxl345->bus))){
+            return -ERESTARTSYS;
+        }
+        if(!READ_ONCE(adxl345->bus))
+            return -ENODEV;
+        if(READ_ONCE(reader->detached))
+            return -EPIPE;
+
+        if(mutex_lock_interruptible(&reader->lock))
+            return -ERESTARTSYS;
+        if(reader->packer.format == ADXL345_FORMAT_PACKED)
+            ret = adxl345_ring_pop_packed(reader, ubuf, len);
+        else
+            ret = adxl345_ring_pop_user(reader, ubuf, len / sizeof(struct adxl345_sample));
+        mutex_unlock(&reader->lock);
+    } while(ret == 0);   // Another thread sharing this file got there first
+    return ret;
+}
+
+// Write function: buf[0] is the first register, the rest are written to consecutive registers
+static ssize_t adxl345_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos) 
+{
+    struct adxl345_reader *reader = filp->private_data;
+    struct adxl345_data *adxl345 = reader->adxl345;
+    ssize_t status = 0;
+    size_t i;
+
+    if (count < 2 || count > sizeof(adxl345->tx_buffer))
+        return -EINVAL;
+
+    mutex_lock(&adxl345->buf_lock);
+    if (copy_from_user(adxl345->tx_buffer, buf, count)) {
+        mutex_unlock(&adxl345->buf_lock);
+        return -EFAULT;
+    }
+    if (adxl345->tx_buffer[0] + count - 1 > ADXL345_REG_MAX + 1) {
+        mutex_unlock(&adxl345->buf_lock);
+        return -EINVAL;
+    }
+    for (i = 1; i < count && status == 0; i++)
+        status = adxl345_write_reg(adxl345, adxl345->tx_buffer[0] + i - 1, adxl345->tx_buffer[i]);
+    mutex_unlock(&adxl345->buf_lock);
+
+    return status < 0 ? status : count;
+}
+
+// Mappings share ctrl->tail; it holds the producer back only while one exists
+static void adxl345_vm_open(struct vm_area_struct *vma)
+{
+    struct adxl345_data *adxl345 = vma->vm_private_data;
+
+    if (atomic_inc_return(&adxl345->mappings) == 1)
+        adxl345_ring_share(adxl345);
+}
+
+static void adxl345_vm_close(struct vm_area_struct *vma)
+{
+    struct adxl345_data *adxl345 = vma->vm_private_data;
+
+    atomic_dec(&adxl345->mappings);
+}
+
+static const struct vm_operations_struct adxl345_vm_ops = {
+    .open               = adxl345_vm_open,
+    .close              = adxl345_vm_close,
+};
+
+// Map the control page and sample ring for zero-copy consumers
+static int adxl345_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct adxl345_reader *reader = filp->private_data;
+    struct adxl345_data *adxl345 = reader->adxl345;
+    int ret;
+
+    if(vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > adxl345->ring.area_size)
+        return -EINVAL;
+    if(!(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+    if(READ_ONCE(adxl345->group))
+        return -EBUSY;
+
+    ret = adxl345_stream_get(adxl345);
+    if(ret < 0)
+        return ret;
+
+    ret = remap_vmalloc_range(vma, adxl345->ring.area, 0);
+    if(ret < 0)
+        return ret;
+
+    vma->vm_private_data = adxl345;
+    vma->vm_ops = &adxl345_vm_ops;
+    adxl345_vm_open(vma);
+    WRITE_ONCE(reader->mapped, true);
+    return 0;
+}
+
+/*
+ * EPOLLIN for samples, EPOLLPRI for events; polling only for events leaves
+ * the stream off. A mapped file consumes through the shared ctrl head/tail,
+ * so it is never attached as a reader here: a cursor it does not advance
+ * would hold the producer back.
+ */
+static __poll_t adxl345_poll(struct file *filp, poll_table *wait)
+{
+    struct adxl345_reader *reader = filp->private_data;
+    struct adxl345_data *adxl345 = reader->adxl345;
+    bool mapped = READ_ONCE(reader->mapped);
+    unsigned int count;
+    __poll_t mask = 0;
+
+    if(poll_requested_events(wait) & (EPOLLIN | EPOLLRDNORM)){
+        if(READ_ONCE(adxl345->group) || adxl345_stream_get(adxl345) < 0)
+            return EPOLLERR;
+        if(!mapped)
+            adxl345_reader_attach(reader);
+    }
+
+    poll_wait(filp, &adxl345->wait, wait);
+    if(mapped && !READ_ONCE(reader->attached))
+        count = adxl345_ring_count(&adxl345->ring);
+    else
+        count = adxl345_reader_count(reader);
+    if(READ_ONCE(reader->detached))
+        mask |= EPOLLERR;
+    else if(count >= READ_ONCE(adxl345->wakeup))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if(!kfifo_is_empty(&adxl345->events))
+        mask |= EPOLLPRI;
+    return mask;
+}
+
+// Next unread sample of a member, or NULL; caller holds group->lock
+static struct adxl345_sample *adxl345_ring_peek(struct adxl345_ring *ring)
+{
+    if (!adxl345_ring_count(ring))
+        return NULL;
+    return &ring->samples[READ_ONCE(ring->ctrl->tail) & (ring->size - 1)];
+}
+
+static void adxl345_ring_skip(struct adxl345_ring *ring, unsigned int count)
+{
+    smp_store_release(&ring->ctrl->tail, ring->ctrl->tail + count);
+}
+
+static void adxl345_group_clear(struct adxl345_group *group)
+{
+    unsigned int i;
+
+    mutex_lock(&device_list_lock);
+    for (i = 0; i < group->count; i++) {
+        WRITE_ONCE(group->members[i]->group, NULL);
+        adxl345_put(group->members[i]);
+    }
+    mutex_unlock(&device_list_lock);
+    group->count = 0;
+}
+
+// Claim the sensors in config->members for this group and start them streaming
+static int adxl345_group_set(struct adxl345_group *group, const struct adxl345_group_config *config)
+{
+    struct adxl345_data *adxl345;
+    unsigned int i;
+    int ret = 0;
+
+    if (config->members >> N_ADXL345_MINORS)
+        return -EINVAL;
+
+    adxl345_group_clear(group);
+    group->tolerance_ns = config->tolerance_ns;
+    group->lost = false;
+
+    mutex_lock(&device_list_lock);
+    for (i = 0; i < N_ADXL345_MINORS && ret == 0; i++) {
+        if (!(config->members & BIT(i)))
+            continue;
+        ret = -ENODEV;
+        list_for_each_entry(adxl345, &device_list, device_entry) {
+            if (MINOR(adxl345->devt) != i)
+                continue;
+            // The group consumes ctrl->tail, which a live mapping already moves
+            ret = adxl345->group || atomic_read(&adxl345->mappings) ||
+                  !list_empty(&adxl345->readers) ? -EBUSY : 0;
+            break;
+        }
+        if (ret < 0)
+            break;
+        adxl345->users++;
+        adxl345_ring_share(adxl345);
+        WRITE_ONCE(adxl345->group, group);
+        group->members[group->count++] = adxl345;
+    }
+    mutex_unlock(&device_list_lock);
+
+    for (i = 0; i < group->count && ret == 0; i++)
+        ret = adxl345_stream_get(group->members[i]);
+    if (ret < 0)
+        adxl345_group_clear(group);
+    return ret;
+}
+
+// Caller holds group->lock
+static bool adxl345_group_ready(struct adxl345_group *group)
+{
+    unsigned int i;
+
+    for (i = 0; i < group->count; i++)
+        if (!adxl345_ring_count(&group->members[i]->ring))
+            return false;
+    return group->count > 0;
+}
+
+// A member whose transport went away will never produce again; caller holds group->lock
+static bool adxl345_group_gone(struct adxl345_group *group)
+{
+    unsigned int i;
+
+    for (i = 0; i < group->count; i++)
+        if (!READ_ONCE(group->members[i]->bus))
+            return true;
+    return false;
+}
+
+/*
+ * Build one frame from the oldest sample of every member. Members whose
+ * next sample is more than tolerance_ns older than the newest candidate
+ * drop samples until they line up. Returns false if some member ran dry.
+ * Caller holds group->lock.
+ */
+static bool adxl345_group_fill(struct adxl345_group *group, struct adxl345_frame *frame)
+{
+    struct adxl345_sample *sample;
+    struct adxl345_ring *ring;
+    s64 newest = S64_MIN;
+    unsigned int i;
+    bool ok = true;
+
+    // group->lock is the only thing needed: a member's ctrl->tail belongs to one group
+    for (i = 0; i < group->count && ok; i++) {
+        sample = adxl345_ring_peek(&group->members[i]->ring);
+        if (!sample)
+            ok = false;
+        else
+            newest = max(newest, sample->timestamp_ns);
+    }
+    for (i = 0; i < group->count && ok; i++) {
+        ring = &group->members[i]->ring;
+        while ((sample = adxl345_ring_peek(ring)) &&
+               sample->timestamp_ns + group->tolerance_ns < newest) {
+            adxl345_ring_skip(ring, 1);
+            group->lost = true;
+        }
+        if (!sample)
+            ok = false;
+    }
+
+    if (ok) {
+        frame->timestamp_ns = newest;
+        frame->count = group->count;
+        frame->flags = group->lost ? ADXL345_SAMPLE_OVERRUN : 0;
+        frame->reserved = 0;
+        group->lost = false;
+        for (i = 0; i < group->count; i++) {
+            ring = &group->members[i]->ring;
+            sample = adxl345_ring_peek(ring);
+            frame->axes[i].x = sample->x;
+            frame->axes[i].y = sample->y;
+            frame->axes[i].z = sample->z;
+            if (sample->flags & ADXL345_SAMPLE_OVERRUN)
+                frame->flags |= ADXL345_SAMPLE_OVERRUN;
+            adxl345_ring_skip(ring, 1);
+        }
+    }
+    return ok;
+}
+
+static int adxl345_group_open(struct inode *inode, struct file *filp)
+{
+    struct adxl345_group *group;
+
+    group = kzalloc(sizeof(*group), GFP_KERNEL);
+    if (!group)
+        return -ENOMEM;
+    mutex_init(&group->lock);
+    filp->private_data = group;
+    return nonseekable_open(inode, filp);
+}
+
+static int adxl345_group_release(struct inode *inode, struct file *filp)
+{
+    struct adxl345_group *group = filp->private_data;
+
+    adxl345_group_clear(group);
+    kfree(group);
+    return 0;
+}
+
+/*
+ * Read whole frames; blocks until every member has at least one sample.
+ * Readiness is only ever judged under group->lock, so the wait uses
+ * wait_woken() to catch a wake-up that lands between the check and the
+ * sleep.
+ */
+static ssize_t adxl345_group_read(struct file *filp, char __user *ubuf, size_t len, loff_t *offset)
+{
+    struct adxl345_group *group = filp->private_data;
+    DEFINE_WAIT_FUNC(wait, woken_wake_function);
+    union {
+        struct adxl345_frame frame;
+        u8 bytes[ADXL345_FRAME_SIZE(N_ADXL345_MINORS)];
+    } buf;
+    size_t frame_size, copied = 0;
+    int ret;
+
+    add_wait_queue(&group_wait, &wait);
+    if (mutex_lock_interruptible(&group->lock)) {
+        remove_wait_queue(&group_wait, &wait);
+        return -ERESTARTSYS;
+    }
+    if (!group->count) {
+        ret = -EINVAL;
+        goto out;
+    }
+    frame_size = ADXL345_FRAME_SIZE(group->count);
+    if (len < frame_size) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    memset(&buf, 0, sizeof(buf));
+    while (copied + frame_size <= len) {
+        if (!adxl345_group_fill(group, &buf.frame)) {
+            if (copied || (filp->f_flags & O_NONBLOCK))
+                break;
+            if (adxl345_group_gone(group)) {
+                ret = -ENODEV;
+                goto out;
+            }
+            mutex_unlock(&group->lock);
+            wait_woken(&wait, TASK_INTERRUPTIBLE, MAX_SCHEDULE_TIMEOUT);
+            if (signal_pending(current)) {
+                remove_wait_queue(&group_wait, &wait);
+                return -ERESTARTSYS;
+            }
+            if (mutex_lock_interruptible(&group->lock)) {
+                remove_wait_queue(&group_wait, &wait);
+                return -ERESTARTSYS;
+            }
+            // GROUP_SET may have changed the members meanwhile
+            if (!group->count) {
+                ret = -EINVAL;
+                goto out;
+            }
+            frame_size = ADXL345_FRAME_SIZE(group->count);
+            if (len < frame_size) {
+                ret = -EINVAL;
+                goto out;
+            }
+            continue;
+        }
+        if (copy_to_user(ubuf + copied, &buf, frame_size)) {
+            ret = copied ? 0 : -EFAULT;
+            goto out;
+        }
+        copied += frame_size;
+    }
+    ret = copied ? 0 : -EAGAIN;
+out:
+    mutex_unlock(&group->lock);
+    remove_wait_queue(&group_wait, &wait);
+    return ret < 0 ? ret : copied;
+}
+
+static __poll_t adxl345_group_poll(struct file *filp, poll_table *wait)
+{
+    struct adxl345_group *group = filp->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(filp, &group_wait, wait);
+    mutex_lock(&group->lock);
+    if (adxl345_group_gone(group))
+        mask = EPOLLERR | EPOLLHUP;
+    else if (adxl345_group_ready(group))
+        mask = EPOLLIN | EPOLLRDNORM;
+    mutex_unlock(&group->lock);
+    return mask;
+}
+
+static long adxl345_group_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct adxl345_group *group = filp->private_data;
+    struct adxl345_group_config config;
+    int ret;
+
+    if (cmd != ADXL345_IOCTL_GROUP_SET)
+        return -ENOTTY;
+    if (copy_from_user(&config, (void __user *)arg, sizeof(config)))
+        return -EFAULT;
+
+    mutex_lock(&group->lock);
+    ret = adxl345_group_set(group, &config);
+    mutex_unlock(&group->lock);
+    return ret;
+}
+
+static const struct file_operations adxl345_group_fops = {
+    .owner              = THIS_MODULE,
+    .open               = adxl345_group_open,
+    .release            = adxl345_group_release,
+    .read               = adxl345_group_read,
+    .poll               = adxl345_group_poll,
+    .unlocked_ioctl     = adxl345_group_ioctl,
+};
+
+// IOCTL function
+static long adxl345_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct adxl345_reader *reader = filp->private_data;
+    struct adxl345_data *adxl345 = reader->adxl345;
+    struct adxl345_sample sample;
+    struct adxl345_config config;
+    struct adxl345_scale scale;
+    struct adxl345_decimation decimation;
+    struct adxl345_event_config events;
+    struct adxl345_event event;
+    struct adxl345_format format;
+    struct adxl345_reader_config reader_config;
+    struct adxl345_fifo_read fifo;
+    u32 value;
+    int data;
+    int ret;
+
+    if (_IOC_TYPE(cmd) != ADXL345_IOCTL_MAGIC)
+        return -ENOTTY;
+
+    switch(cmd){
+        case ADXL345_IOCTL_SET_WAKEUP:
+            if(get_user(value, (u32 __user *)arg))
+                return -EFAULT;
+            if(value < 1 || value > adxl345->ring.size)
+                return -EINVAL;
+            WRITE_ONCE(adxl345->wakeup, value);
+            wake_up_interruptible(&adxl345->wait);
+            return 0;
+        case ADXL345_IOCTL_GET_CONFIG:
+            adxl345_get_config(adxl345, &config);
+            if(copy_to_user((void __user *)arg, &config, sizeof(config)))
+                return -EFAULT;
+            return 0;
+        case ADXL345_IOCTL_SET_CONFIG:
+            if(copy_from_user(&config, (void __user *)arg, sizeof(config)))
+                return -EFAULT;
+            return adxl345_set_config(adxl345, &config);
+        case ADXL345_IOCTL_GET_SCALE:
+            scale.ug_per_lsb = READ_ONCE(adxl345->scale)->ug_per_lsb;
+            scale.nms2_per_lsb = READ_ONCE(adxl345->scale)->nms2_per_lsb;
+            if(copy_to_user((void __user *)arg, &scale, sizeof(scale)))
+                return -EFAULT;
+            return 0;
+        case ADXL345_IOCTL_SET_DECIMATION:
+            if(copy_from_user(&decimation, (void __user *)arg, sizeof(decimation)))
+                return -EFAULT;
+            return adxl345_set_decimation(adxl345, &decimation);
+        case ADXL345_IOCTL_GET_DECIMATION:
+            decimation.ratio = 1U << READ_ONCE(adxl345->decim.shift);
+            decimation.order = READ_ONCE(adxl345->decim.order);
+            if(copy_to_user((void __user *)arg, &decimation, sizeof(decimation)))
+                return -EFAULT;
+            return 0;
+        case ADXL345_IOCTL_SET_EVENTS:
+            if(copy_from_user(&events, (void __user *)arg, sizeof(events)))
+                return -EFAULT;
+            return adxl345_set_events(adxl345, &events);
+        case ADXL345_IOCTL_GET_EVENTS:
+            mutex_lock(&adxl345->lock);
+            events = adxl345->event_config;
+            mutex_unlock(&adxl345->lock);
+            if(copy_to_user((void __user *)arg, &events, sizeof(events)))
+                return -EFAULT;
+            return 0;
+        case ADXL345_IOCTL_READ_EVENT:
+            ret = adxl345_read_event(adxl345, filp, &event);
+            if(ret < 0)
+                return ret;
+            if(copy_to_user((void __user *)arg, &event, sizeof(event)))
+                return -EFAULT;
+            return 0;
+        case ADXL345_IOCTL_SET_FORMAT:
+            if(copy_from_user(&format, (void __user *)arg, sizeof(format)))
+                return -EFAULT;
+            return adxl345_set_format(reader, &format);
+        case ADXL345_IOCTL_GET_FORMAT:
+            mutex_lock(&reader->lock);
+            format.format = reader->packer.format;
+            format.anchor_interval = reader->packer.anchor_interval;
+            mutex_unlock(&reader->lock);
+            if(copy_to_user((void __user *)arg, &format, sizeof(format)))
+                return -EFAULT;
+            return 0;
+        case ADXL345_IOCTL_SET_READER:
+            if(copy_from_user(&reader_config, (void __user *)arg, sizeof(reader_config)))
+                return -EFAULT;
+            return adxl345_set_reader(reader, &reader_config);
+        case ADXL345_IOCTL_GET_READER:
+            memset(&reader_config, 0, sizeof(reader_config));
+            spin_lock_irq(&adxl345->readers_lock);
+            reader_config.policy = reader->policy;
+            reader_config.dropped = reader->dropped;
+            spin_unlock_irq(&adxl345->readers_lock);
+            if(copy_to_user((void __user *)arg, &reader_config, sizeof(reader_config)))
+                return -EFAULT;
+            return 0;
+        case ADXL345_IOCTL_READ_FIFO:
+            if(copy_from_user(&fifo, (void __user *)arg, sizeof(fifo)))
+                return -EFAULT;
+            mutex_lock(&reader->lock);
+            ret = adxl345_fifo_poll(reader, &fifo);
+            mutex_unlock(&reader->lock);
+            if(ret < 0)
+                return ret;
+            if(copy_to_user((void __user *)arg, &fifo, sizeof(fifo)))
+                return -EFAULT;
+            return 0;
+    }
+
+    // Reading DATAX0 pops the FIFO, so direct reads would steal streamed or polled samples
+    if(READ_ONCE(adxl345->streaming) || READ_ONCE(adxl345->fifo_polled))
+        return -EBUSY;
+
+    switch(cmd){
+        case ADXL345_IOCTL_READ_X:
+            ret = adxl345_read_data(adxl345, 0, &data);
+            break;
+        case ADXL345_IOCTL_READ_Y:
+            ret = adxl345_read_data(adxl345, 1, &data);
+            break;
+        case ADXL345_IOCTL_READ_Z:
+            ret = adxl345_read_data(adxl345, 2, &data);
+            break;
+        case ADXL345_IOCTL_READ_XYZ:
+            ret = adxl345_read_sample(adxl345, &sample);
+            if(ret < 0)
+                return ret;
+            if(copy_to_user((struct adxl345_sample __user *)arg, &sample, sizeof(sample)))
+                return -EFAULT;
+            return 0;
+        default:
+            return -ENOTTY;
+    }
+    if(ret < 0)
+        return ret;
+
+    if(copy_to_user((int __user *)arg, &data, sizeof(data))){
+        return -EFAULT;
+    }
+    return 0;
+}
+
+// File operations structure
+static const struct file_operations adxl345_fops = {
+    .owner              = THIS_MODULE,
+    .open               = adxl345_open,
+    .release            = adxl345_release,
+    .read               = adxl345_read,
+    .write              = adxl345_write,
+    .mmap               = adxl345_mmap,
+    .poll               = adxl345_poll,
+    .unlocked_ioctl     = adxl345_ioctl,
+};
+
+// Pick the highest rate that does not exceed the request
+static u8 adxl345_uhz_to_rate(u64 uhz)
+{
+    unsigned int code;
+
+    for (code = ADXL345_BW_RATE_MAX; code > 0; code--)
+        if (adxl345_rate_to_uhz(code) <= uhz)
+            break;
+    return code;
+}
+
+static ssize_t overruns_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(adxl345->ring.ctrl->overruns));
+}
+static DEVICE_ATTR_RO(overruns);
+
+static ssize_t events_lost_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(adxl345->events_lost));
+}
+static DEVICE_ATTR_RO(events_lost);
+
+static ssize_t samples_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(adxl345->stats.samples));
+}
+static DEVICE_ATTR_RO(samples);
+
+static ssize_t fifo_overruns_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(adxl345->stats.fifo_overruns));
+}
+static DEVICE_ATTR_RO(fifo_overruns);
+
+static ssize_t bus_errors_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lld\n", atomic64_read(&adxl345->stats.bus_errors));
+}
+static DEVICE_ATTR_RO(bus_errors);
+
+static ssize_t retries_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lld\n", atomic64_read(&adxl345->stats.retries));
+}
+static DEVICE_ATTR_RO(retries);
+
+static ssize_t range_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n",
+                      adxl345_ranges_g[READ_ONCE(adxl345->data_format) & ADXL345_DATA_FORMAT_RANGE]);
+}
+
+static ssize_t range_store(struct device *dev, struct device_attribute *attr,
+                           const char *buf, size_t count)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+    unsigned int g;
+    int range, ret;
+
+    ret = kstrtouint(buf, 0, &g);
+    if (ret < 0)
+        return ret;
+    range = adxl345_range_code(g);
+    if (range < 0)
+        return range;
+    ret = adxl345_update_config(adxl345, ADXL345_DATA_FORMAT_RANGE, range, 0, 0);
+    return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(range);
+
+static ssize_t full_res_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", !!(READ_ONCE(adxl345->data_format) & ADXL345_DATA_FORMAT_FULL_RES));
+}
+
+static ssize_t full_res_store(struct device *dev, struct device_attribute *attr,
+                              const char *buf, size_t count)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+    bool on;
+    int ret;
+
+    ret = kstrtobool(buf, &on);
+    if (ret < 0)
+        return ret;
+    ret = adxl345_update_config(adxl345, ADXL345_DATA_FORMAT_FULL_RES,
+                                on ? ADXL345_DATA_FORMAT_FULL_RES : 0, 0, 0);
+    return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(full_res);
+
+// Output data rate in Hz, e.g. "3200" or "12.5"; rounded down to a BW_RATE step
+static ssize_t odr_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+    u32 uhz_frac;
+    u64 hz = div_u64_rem(adxl345_rate_to_uhz(READ_ONCE(adxl345->bw_rate) & ADXL345_BW_RATE_MASK),
+                         1000000, &uhz_frac);
+
+    return sysfs_emit(buf, "%llu.%06u\n", hz, uhz_frac);
+}
+
+static ssize_t odr_store(struct device *dev, struct device_attribute *attr,
+                         const char *buf, size_t count)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+    int hz, uhz, ret;
+
+    ret = iio_str_to_fixpoint(buf, 100000, &hz, &uhz);
+    if (ret < 0)
+        return ret;
+    if (hz < 0 || uhz < 0)
+        return -EINVAL;
+    ret = adxl345_update_config(adxl345, 0, 0, ADXL345_BW_RATE_MASK,
+                                adxl345_uhz_to_rate((u64)hz * 1000000 + uhz));
+    return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(odr);
+
+static ssize_t low_power_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", !!(READ_ONCE(adxl345->bw_rate) & ADXL345_BW_RATE_LOW_POWER));
+}
+
+static ssize_t low_power_store(struct device *dev, struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+    bool on;
+    int ret;
+
+    ret = kstrtobool(buf, &on);
+    if (ret < 0)
+        return ret;
+    ret = adxl345_update_config(adxl345, 0, 0, ADXL345_BW_RATE_LOW_POWER,
+                                on ? ADXL345_BW_RATE_LOW_POWER : 0);
+    return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(low_power);
+
+// Output data rate as measured by the timestamp model, in Hz
+static ssize_t odr_measured_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+    u64 period_q16 = READ_ONCE(adxl345->timing.period_q16);
+    u32 uhz_frac;
+    u64 hz;
+
+    if (!READ_ONCE(adxl345->streaming) || !period_q16)
+        return -ENODATA;
+    hz = div_u64_rem(mul_u64_u64_div_u64(1000000000000000ULL, 1 << 16, period_q16),
+                     1000000, &uhz_frac);
+    return sysfs_emit(buf, "%llu.%06u\n", hz, uhz_frac);
+}
+static DEVICE_ATTR_RO(odr_measured);
+
+static ssize_t timestamp_clock_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", READ_ONCE(adxl345->boottime) ? "boottime" : "monotonic");
+}
+
+// Only while stopped, so one stream never mixes two clocks
+static ssize_t timestamp_clock_store(struct device *dev, struct device_attribute *attr,
+                                     const char *buf, size_t count)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+    int ret = 0;
+    bool boottime;
+
+    if (sysfs_streq(buf, "boottime"))
+        boottime = true;
+    else if (sysfs_streq(buf, "monotonic"))
+        boottime = false;
+    else
+        return -EINVAL;
+
+    mutex_lock(&adxl345->lock);
+    if (adxl345->streaming)
+        ret = -EBUSY;
+    else
+        WRITE_ONCE(adxl345->boottime, boottime);
+    mutex_unlock(&adxl345->lock);
+    return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(timestamp_clock);
+
+static ssize_t autosleep_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", READ_ONCE(adxl345->autosleep));
+}
+
+static ssize_t autosleep_store(struct device *dev, struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+    bool on;
+    int ret;
+
+    ret = kstrtobool(buf, &on);
+    if (ret < 0)
+        return ret;
+    ret = adxl345_set_autosleep(adxl345, on);
+    return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(autosleep);
+
+static ssize_t acq_cpu_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", READ_ONCE(adxl345->acq_cpu));
+}
+
+// Pin the acquisition thread to one CPU, or -1 to let it run anywhere
+static ssize_t acq_cpu_store(struct device *dev, struct device_attribute *attr,
+                             const char *buf, size_t count)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+    int cpu, old, ret;
+
+    ret = kstrtoint(buf, 0, &cpu);
+    if (ret < 0)
+        return ret;
+    if (cpu < -1 || (cpu >= 0 && (cpu >= nr_cpu_ids || !cpu_online(cpu))))
+        return -EINVAL;
+
+    mutex_lock(&adxl345->lock);
+    old = adxl345->acq_cpu;
+    WRITE_ONCE(adxl345->acq_cpu, cpu);
+    ret = adxl345_acq_apply(adxl345);
+    if (ret < 0)
+        WRITE_ONCE(adxl345->acq_cpu, old);
+    mutex_unlock(&adxl345->lock);
+    return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(acq_cpu);
+
+static ssize_t acq_priority_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(adxl345->acq_priority));
+}
+
+// SCHED_FIFO priority of the acquisition thread, 1-99; 0 makes it SCHED_NORMAL
+static ssize_t acq_priority_store(struct device *dev, struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    struct adxl345_data *adxl345 = dev_get_drvdata(dev);
+    unsigned int prio, old;
+    int ret;
+
+    ret = kstrtouint(buf, 0, &prio);
+    if (ret < 0)
+        return ret;
+    if (prio >= MAX_RT_PRIO)
+        return -EINVAL;
+
+    mutex_lock(&adxl345->lock);
+    old = adxl345->acq_priority;
+    WRITE_ONCE(adxl345->acq_priority, prio);
+    ret = adxl345_acq_apply(adxl345);
+    if (ret < 0)
+        WRITE_ONCE(adxl345->acq_priority, old);
+    mutex_unlock(&adxl345->lock);
+    return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(acq_priority);
+
+static struct attribute *adxl345_attrs[] = {
+    &dev_attr_overruns.attr,
+    &dev_attr_events_lost.attr,
+    &dev_attr_samples.attr,
+    &dev_attr_fifo_overruns.attr,
+    &dev_attr_bus_errors.attr,
+    &dev_attr_retries.attr,
+    &dev_attr_range.attr,
+    &dev_attr_full_res.attr,
+    &dev_attr_odr.attr,
+    &dev_attr_low_power.attr,
+    &dev_attr_odr_measured.attr,
+    &dev_attr_timestamp_clock.attr,
+    &dev_attr_autosleep.attr,
+    &dev_attr_acq_cpu.attr,
+    &dev_attr_acq_priority.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(adxl345);
+
+#define ADXL345_ACCEL_CHANNEL(index, axis) {                          \
+    .type = IIO_ACCEL,                                                  \
+    .modified = 1,                                                      \
+    .channel2 = IIO_MOD_##axis,                                         \
+    .info_mask_separate = BIT(IIO_CHAN_INFO_RAW),                       \
+    .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE),               \
+    .info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),            \
+    .scan_index = index,                                                \
+    .scan_type = {                                                      \
+        .sign = 's',                                                    \
+        .realbits = 13,                                                 \
+        .storagebits = 16,                                              \
+        .endianness = IIO_LE,                                           \
+    },                                                                  \
+}
+
+static const struct iio_chan_spec adxl345_channels[] = {
+    ADXL345_ACCEL_CHANNEL(0, X),
+    ADXL345_ACCEL_CHANNEL(1, Y),
+    ADXL345_ACCEL_CHANNEL(2, Z),
+    IIO_CHAN_SOFT_TIMESTAMP(3),
+};
+
+static int adxl345_read_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan,
+                            int *val, int *val2, long mask)
+{
+    struct adxl345_data *adxl345 = iio_device_get_drvdata(indio_dev);
+    struct adxl345_sample sample;
+    u64 uhz;
+    int ret;
+
+    switch (mask) {
+    case IIO_CHAN_INFO_RAW:
+        // Same rule as the READ_* ioctls: direct reads would pop the FIFO
+        if (READ_ONCE(adxl345->streaming) || READ_ONCE(adxl345->fifo_polled))
+            return -EBUSY;
+        ret = adxl345_read_sample(adxl345, &sample);
+        if (ret < 0)
+            return ret;
+        *val = chan->channel2 == IIO_MOD_X ? sample.x :
+               chan->channel2 == IIO_MOD_Y ? sample.y : sample.z;
+        return IIO_VAL_INT;
+    case IIO_CHAN_INFO_SCALE:
+        *val = 0;
+        *val2 = READ_ONCE(adxl345->scale)->nms2_per_lsb;
+        return IIO_VAL_INT_PLUS_NANO;
+    case IIO_CHAN_INFO_SAMP_FREQ:
+        uhz = adxl345_rate_to_uhz(READ_ONCE(adxl345->bw_rate) & ADXL345_BW_RATE_MASK);
+        *val = div_u64_rem(uhz, 1000000, val2);
+        return IIO_VAL_INT_PLUS_MICRO;
+    }
+    return -EINVAL;
+}
+
+static int adxl345_write_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan,
+                             int val, int val2, long mask)
+{
+    struct adxl345_data *adxl345 = iio_device_get_drvdata(indio_dev);
+
+    if (mask != IIO_CHAN_INFO_SAMP_FREQ)
+        return -EINVAL;
+    if (val < 0 || val2 < 0)
+        return -EINVAL;
+
+    return adxl345_update_config(adxl345, 0, 0, ADXL345_BW_RATE_MASK,
+                                 adxl345_uhz_to_rate((u64)val * 1000000 + val2));
+}
+
+static const struct iio_info adxl345_iio_info = {
+    .read_raw       = adxl345_read_raw,
+    .write_raw      = adxl345_write_raw,
+};
+
+// The IIO buffer shares the FIFO stream with the character device
+static int adxl345_buffer_postenable(struct iio_dev *indio_dev)
+{
+    struct adxl345_data *adxl345 = iio_device_get_drvdata(indio_dev);
+    int ret = 0;
+
+    mutex_lock(&adxl345->lock);
+    if (!adxl345->streaming)
+        ret = adxl345_stream_start(adxl345);
+    if (ret == 0)
+        adxl345->iio_active = true;
+    mutex_unlock(&adxl345->lock);
+    return ret;
+}
+
+static int adxl345_buffer_predisable(struct iio_dev *indio_dev)
+{
+    struct adxl345_data *adxl345 = iio_device_get_drvdata(indio_dev);
+
+    mutex_lock(&adxl345->lock);
+    adxl345->iio_active = false;
+    if (adxl345->users == 0 && adxl345->streaming)
+        adxl345_stream_stop(adxl345);
+    mutex_unlock(&adxl345->lock);
+    return 0;
+}
+
+static const struct iio_buffer_setup_ops adxl345_buffer_ops = {
+    .postenable     = adxl345_buffer_postenable,
+    .predisable     = adxl345_buffer_predisable,
+};
+
+static int adxl345_iio_init(struct adxl345_data *adxl345)
+{
+    struct device *dev = adxl345->dev;
+    struct iio_dev *indio_dev;
+    int ret;
+
+    indio_dev = devm_iio_device_alloc(dev, 0);
+    if (!indio_dev)
+        return -ENOMEM;
+
+    indio_dev->name = DEVICE_NAME;
+    indio_dev->info = &adxl345_iio_info;
+    indio_dev->channels = adxl345_channels;
+    indio_dev->num_channels = ARRAY_SIZE(adxl345_channels);
+    indio_dev->modes = INDIO_DIRECT_MODE;
+    iio_device_set_drvdata(indio_dev, adxl345);
+
+    ret = devm_iio_kfifo_buffer_setup(dev, indio_dev, &adxl345_buffer_ops);
+    if (ret < 0)
+        return ret;
+
+    adxl345->indio_dev = indio_dev;
+    return iio_device_register(indio_dev);
+}
+
+// One "<low_us> <count>" line per bucket of the IRQ-to-ring latency histogram
+static int adxl345_irq_latency_show(struct seq_file *s, void *unused)
+{
+    struct adxl345_data *adxl345 = s->private;
+    unsigned int i;
+
+    for (i = 0; i < ADXL345_LATENCY_BUCKETS; i++)
+        seq_printf(s, "%u %llu\n", i ? 1U << (i - 1) : 0,
+                   READ_ONCE(adxl345->stats.irq_latency[i]));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(adxl345_irq_latency);
+
+// Same layout, from the IRQ or poll timer to the acquisition thread touching the bus
+static int adxl345_wake_latency_show(struct seq_file *s, void *unused)
+{
+    struct adxl345_data *adxl345 = s->private;
+    unsigned int i;
+
+    for (i = 0; i < ADXL345_LATENCY_BUCKETS; i++)
+        seq_printf(s, "%u %llu\n", i ? 1U << (i - 1) : 0,
+                   READ_ONCE(adxl345->stats.wake_latency[i]));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(adxl345_wake_latency);
+
+// Probe function, called by the I2C and SPI transports
+struct adxl345_data *adxl345_core_probe(struct device *dev, const struct adxl345_bus_ops *ops,
+                                        void *bus, int irq)
+{
+    struct adxl345_data *adxl345, **res;
+    struct device *cdev;
+    unsigned long minor;
+    char name[16];
+    int ret;
+
+    adxl345 = kzalloc(sizeof(*adxl345), GFP_KERNEL);
+    if (!adxl345)
+        return ERR_PTR(-ENOMEM);
+
+    adxl345->dev = dev;
+    adxl345->ops = ops;
+    adxl345->bus = bus;
+    adxl345->irq = irq;
+    adxl345->wakeup = 1;
+    adxl345->scale = adxl345_scale_lookup(0);
+    adxl345->decim.order = 1;
+    INIT_LIST_HEAD(&adxl345->readers);
+    spin_lock_init(&adxl345->readers_lock);
+    atomic_set(&adxl345->mappings, 0);
+    mutex_init(&adxl345->bus_lock);
+    mutex_init(&adxl345->buf_lock);
+    mutex_init(&adxl345->lock);
+    init_waitqueue_head(&adxl345->wait);
+    INIT_LIST_HEAD(&adxl345->device_entry);
+    INIT_KFIFO(adxl345->events);
+    spin_lock_init(&adxl345->event_lock);
+    INIT_WORK(&adxl345->sleep_work, adxl345_sleep_work);
+    kthread_init_work(&adxl345->acq_work, adxl345_acq_work);
+    hrtimer_init(&adxl345->acq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    adxl345->acq_timer.function = adxl345_acq_tick;
+    adxl345->acq_cpu = -1;
+    adxl345->acq_priority = MAX_RT_PRIO / 2;    // Where threaded IRQs run by default
+
+    // Not devm: open fds may keep using the regmap after the transport unbinds
+    adxl345->regmap = regmap_init(dev, &adxl345_regmap_bus, adxl345, &adxl345_regmap_config);
+    if (IS_ERR(adxl345->regmap)) {
+        ret = PTR_ERR(adxl345->regmap);
+        kfree(adxl345);
+        return ERR_PTR(ret);
+    }
+    get_device(dev);
+
+    res = devres_alloc(adxl345_devres_release, sizeof(*res), GFP_KERNEL);
+    if (!res) {
+        ret = -ENOMEM;
+        goto err_free;
+    }
+
+    ret = adxl345_write_reg(adxl345, ADXL345_REG_DATA_FORMAT, ADXL345_DATA_FORMAT_FULL_RES);
+    if (ret < 0) {
+        dev_err(dev, "Failed to set data format for ADXL345\n");
+        goto err_devres;
+    }
+    ret = adxl345_write_reg(adxl345, ADXL345_REG_BW_RATE, ADXL345_BW_RATE_DEFAULT);
+    if (ret < 0) {
+        dev_err(dev, "Failed to set ADXL345 output data rate\n");
+        goto err_devres;
+    }
+    ret = adxl345_write_reg(adxl345, ADXL345_REG_PWR_CTL, ADXL345_PWR_CTL_MEASURE);
+    if (ret < 0) {
+        dev_err(dev, "Failed to start ADXL345 measurement\n");
+        goto err_devres;
+    }
+
+    // Measuring now; drop to standby once nothing has used the sensor for a while
+    pm_runtime_set_active(dev);
+    pm_runtime_set_autosuspend_delay(dev, AUTOSUSPEND_MS);
+    pm_runtime_use_autosuspend(dev);
+    ret = devm_pm_runtime_enable(dev);
+    if (ret < 0)
+        goto err_devres;
+    pm_runtime_get_noresume(dev);
+
+    ret = adxl345_ring_init(&adxl345->ring, buffer_samples);
+    if (ret < 0)
+        goto err_pm;
+    adxl345->acq_worker = kthread_create_worker(0, DEVICE_NAME "/%s", dev_name(dev));
+    if (IS_ERR(adxl345->acq_worker)) {
+        ret = PTR_ERR(adxl345->acq_worker);
+        goto err_ring;
+    }
+    ret = adxl345_acq_apply(adxl345);
+    if (ret < 0)
+        goto err_worker;
+    if (irq > 0) {
+        // The hard handler only masks and queues, so a nested-threaded line works as well
+        ret = request_any_context_irq(irq, adxl345_irq, 0, DEVICE_NAME, adxl345);
+        if (ret < 0) {
+            dev_err(dev, "Failed to request ADXL345 IRQ %d\n", irq);
+            goto err_worker;
+        }
+    }
+
+    mutex_lock(&device_list_lock);
+    minor = find_first_zero_bit(minors, N_ADXL345_MINORS);
+    if (minor >= N_ADXL345_MINORS) {
+        mutex_unlock(&device_list_lock);
+        dev_dbg(dev, "no minor number available!\n");
+        ret = -ENODEV;
+        goto err_irq;
+    }
+    // The first sensor keeps the historical /dev/adxl345 name
+    if (minor == 0)
+        strscpy(name, DEVICE_NAME, sizeof(name));
+    else
+        snprintf(name, sizeof(name), DEVICE_NAME "-%lu", minor);
+    adxl345->devt = MKDEV(major_number, minor);
+    cdev = device_create_with_groups(adxl345_class, dev, adxl345->devt, adxl345,
+                                     adxl345_groups, "%s", name);
+    if (IS_ERR(cdev)) {
+        mutex_unlock(&device_list_lock);
+        ret = PTR_ERR(cdev);
+        goto err_irq;
+    }
+    set_bit(minor, minors);
+    list_add(&adxl345->device_entry, &device_list);
+    mutex_unlock(&device_list_lock);
+
+    ret = adxl345_iio_init(adxl345);
+    if (ret < 0) {
+        dev_err(dev, "Failed to register IIO device\n");
+        mutex_lock(&device_list_lock);
+        list_del(&adxl345->device_entry);
+        device_destroy(adxl345_class, adxl345->devt);
+        clear_bit(minor, minors);
+        mutex_unlock(&device_list_lock);
+        goto err_irq;
+    }
+
+    // From here on the PM callbacks find the core data
+    *res = adxl345;
+    devres_add(dev, res);
+
+    adxl345->debugfs = debugfs_create_dir(name, adxl345_debugfs);
+    debugfs_create_file("irq_latency", 0444, adxl345->debugfs, adxl345,
+                        &adxl345_irq_latency_fops);
+    debugfs_create_file("wake_latency", 0444, adxl345->debugfs, adxl345,
+                        &adxl345_wake_latency_fops);
+
+    dev_info(dev, "ADXL345 registered as /dev/%s\n", name);
+    pm_runtime_mark_last_busy(dev);
+    pm_runtime_put_autosuspend(dev);
+    return adxl345;
+
+err_irq:
+    if (irq > 0)
+        free_irq(irq, adxl345);
+err_worker:
+    kthread_destroy_worker(adxl345->acq_worker);
+err_ring:
+    adxl345_ring_free(&adxl345->ring);
+err_pm:
+    pm_runtime_put_noidle(dev);
+err_devres:
+    devres_free(res);
+err_free:
+    regmap_exit(adxl345->regmap);
+    put_device(dev);
+    kfree(adxl345);
+    return ERR_PTR(ret);
+}
+EXPORT_SYMBOL_GPL(adxl345_core_probe);
+
+// Remove function
+void adxl345_core_remove(struct adxl345_data *adxl345)
+{
+    debugfs_remove_recursive(adxl345->debugfs);
+    iio_device_unregister(adxl345->indio_dev);
+
+    mutex_lock(&adxl345->lock);
+    // From here on stream_get() and READ_FIFO fail instead of restarting the FIFO
+    adxl345->removed = true;
+    if (adxl345->streaming)
+        adxl345_stream_stop(adxl345);
+    adxl345_fifo_poll_stop(adxl345);
+    adxl345_events_pm(adxl345, adxl345_int_events(adxl345), 0);
+    WRITE_ONCE(adxl345->event_mask, 0);
+    WRITE_ONCE(adxl345->autosleep, false);
+    adxl345_write_reg(adxl345, ADXL345_REG_INT_ENABLE, 0);
+    mutex_unlock(&adxl345->lock);
+    // Keep the line masked while a queued drain unmasks it, then let go of it
+    if (adxl345->irq > 0)
+        disable_irq(adxl345->irq);
+    kthread_flush_worker(adxl345->acq_worker);
+    if (adxl345->irq > 0)
+        free_irq(adxl345->irq, adxl345);
+    cancel_work_sync(&adxl345->sleep_work);
+    // Detach the PM callbacks and wait out any that are running
+    devres_release(adxl345->dev, adxl345_devres_release, NULL, NULL);
+    pm_runtime_barrier(adxl345->dev);
+
+    // Prevent new opens
+    mutex_lock(&device_list_lock);
+    // Make sure ops on existing fds can abort cleanly
+    mutex_lock(&adxl345->bus_lock);
+    adxl345->bus = NULL;
+    mutex_unlock(&adxl345->bus_lock);
+    wake_up_interruptible(&adxl345->wait);
+    if (READ_ONCE(adxl345->group))
+        wake_up_interruptible(&group_wait);
+
+    list_del(&adxl345->device_entry);
+    device_destroy(adxl345_class, adxl345->devt);
+    clear_bit(MINOR(adxl345->devt), minors);
+    // No sysfs store can reach the thread any more, nor a poll timer queue work on it
+    hrtimer_cancel(&adxl345->acq_timer);
+    kthread_destroy_worker(adxl345->acq_worker);
+    if (adxl345->users == 0)
+        adxl345_free(adxl345);
+
+    mutex_unlock(&device_list_lock);
+}
+EXPORT_SYMBOL_GPL(adxl345_core_remove);
+
+// Module init function
+static int __init adxl345_init(void)
+{
+    struct device *dev;
+
+    printk(KERN_INFO "Initializing ADXL345 core driver!!!\n");
+    if (watermark < 1 || watermark >= ADXL345_FIFO_DEPTH)
+        watermark = 16;
+    adxl345_class = class_create(CLASS_NAME);
+    if (IS_ERR(adxl345_class))
+        return PTR_ERR(adxl345_class);
+
+    major_number = register_chrdev(0, DEVICE_NAME, &adxl345_fops);
+    if (major_number < 0) {
+        printk(KERN_ERR "Failed to register a major number\n");
+        class_destroy(adxl345_class);
+        return major_number;
+    }
+
+    dev = device_create(adxl345_class, NULL, MKDEV(major_number, ADXL345_GROUP_MINOR), NULL,
+                        DEVICE_NAME "_group");
+    if (IS_ERR(dev)) {
+        unregister_chrdev(major_number, DEVICE_NAME);
+        class_destroy(adxl345_class);
+        return PTR_ERR(dev);
+    }
+    adxl345_debugfs = debugfs_create_dir(DEVICE_NAME, NULL);
+    return 0;
+}
+
+// Module exit function
+static void __exit adxl345_exit(void)
+{
+    printk(KERN_INFO "Exiting ADXL345 core driver!!!\n");
+    debugfs_remove_recursive(adxl345_debugfs);
+    device_destroy(adxl345_class, MKDEV(major_number, ADXL345_GROUP_MINOR));
+    unregister_chrdev(major_number, DEVICE_NAME);
+    class_destroy(adxl345_class);
+}
+
+module_init(adxl345_init);
+module_exit(adxl345_exit);
+
+MODULE_AUTHOR("Syaoran");
+MODULE_DESCRIPTION("ADXL345 core driver: register map, FIFO streaming, char and IIO interfaces");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,360 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/irq.h>
+#include <linux/irq_sim.h>
+#include <linux/irqdomain.h>
+#include <linux/interrupt.h>
+
+#include "adxl345.h"
+
+/*
+ * Emulated ADXL345 transport. Models the register file, the 32-entry FIFO
+ * in bypass and stream mode, the output data rate from BW_RATE and the
+ * watermark/overrun interrupts (through an irq_sim domain), so the core's
+ * char and IIO paths can be exercised and benchmarked without hardware.
+ */
+
+#define DRIVER_NAME             "adxl345_emul"
+
+#define ADXL345_DEVID           0xE5
+#define ADXL345_INT_DATA_READY  BIT(7)
+#define ADXL345_FIFO_MODE(x)    ((x) & 0xC0)
+#define ADXL345_FIFO_SAMPLES(x) ((x) & 0x1F)
+
+static unsigned int sensors = 1;
+module_param(sensors, uint, 0444);
+MODULE_PARM_DESC(sensors, "Number of emulated sensors to create");
+
+struct adxl345_emul {
+    struct adxl345_data *adxl345;
+    spinlock_t lock;                // Registers and FIFO; taken from the hrtimer too
+    u8 regs[ADXL345_REG_MAX + 1];
+    u8 output[ADXL345_SAMPLE_SIZE]; // DATAX0..DATAZ1 in bypass mode
+    u8 fifo[ADXL345_FIFO_DEPTH][ADXL345_SAMPLE_SIZE];
+    unsigned int fifo_head;
+    unsigned int fifo_count;
+    bool overrun;
+    u64 tick;
+    struct hrtimer timer;
+    struct fwnode_handle *fwnode;
+    struct irq_domain *domain;
+    int irq;
+};
+
+static struct platform_device *emul_pdevs[N_ADXL345_MINORS];
+
+// BW_RATE code 0x0F is 3200 Hz; each step down doubles the period
+static ktime_t adxl345_emul_period(struct adxl345_emul *emul)
+{
+    unsigned int code = emul->regs[ADXL345_REG_BW_RATE] & ADXL345_BW_RATE_MASK;
+
+    return ns_to_ktime(312500ULL << (ADXL345_BW_RATE_MAX - code));
+}
+
+static bool adxl345_emul_irq_pending(struct adxl345_emul *emul)
+{
+    u8 enable = emul->regs[ADXL345_REG_INT_ENABLE];
+    u8 fifo_ctl = emul->regs[ADXL345_REG_FIFO_CTL];
+
+    if (ADXL345_FIFO_MODE(fifo_ctl) == ADXL345_FIFO_BYPASS)
+        return false;
+    if ((enable & ADXL345_INT_WATERMARK) && emul->fifo_count >= ADXL345_FIFO_SAMPLES(fifo_ctl))
+        return true;
+    return (enable & ADXL345_INT_OVERRUN) && emul->overrun;
+}
+
+// The INT1 line is level-triggered on the real part; re-raise while it would stay high
+static void adxl345_emul_raise(struct adxl345_emul *emul)
+{
+    irq_set_irqchip_state(emul->irq, IRQCHIP_STATE_PENDING, true);
+}
+
+// A slow triangle on X/Y and 1 g (256 LSB at full resolution) on Z
+static void adxl345_emul_sample(struct adxl345_emul *emul, u8 *raw)
+{
+    s16 x = (s16)(emul->tick % 512) - 256;
+    s16 z = 256;
+
+    raw[0] = x & 0xFF;
+    raw[1] = x >> 8;
+    raw[2] = (-x) & 0xFF;
+    raw[3] = (-x) >> 8;
+    raw[4] = z & 0xFF;
+    raw[5] = z >> 8;
+}
+
+static enum hrtimer_restart adxl345_emul_tick(struct hrtimer *timer)
+{
+    struct adxl345_emul *emul = container_of(timer, struct adxl345_emul, timer);
+    unsigned long flags;
+    unsigned int slot;
+    bool raise;
+
+    spin_lock_irqsave(&emul->lock, flags);
+    emul->tick++;
+    adxl345_emul_sample(emul, emul->output);
+
+    if (ADXL345_FIFO_MODE(emul->regs[ADXL345_REG_FIFO_CTL]) != ADXL345_FIFO_BYPASS) {
+        // Stream mode: a full FIFO overwrites its oldest entry
+        if (emul->fifo_count == ADXL345_FIFO_DEPTH) {
+            emul->fifo_head = (emul->fifo_head + 1) % ADXL345_FIFO_DEPTH;
+            emul->fifo_count--;
+            emul->overrun = true;
+        }
+        slot = (emul->fifo_head + emul->fifo_count) % ADXL345_FIFO_DEPTH;
+        memcpy(emul->fifo[slot], emul->output, ADXL345_SAMPLE_SIZE);
+        emul->fifo_count++;
+    }
+    raise = adxl345_emul_irq_pending(emul);
+    spin_unlock_irqrestore(&emul->lock, flags);
+
+    if (raise)
+        adxl345_emul_raise(emul);
+
+    hrtimer_forward_now(timer, adxl345_emul_period(emul));
+    return HRTIMER_RESTART;
+}
+
+static void adxl345_emul_restart(struct adxl345_emul *emul)
+{
+    hrtimer_cancel(&emul->timer);
+    if (emul->regs[ADXL345_REG_PWR_CTL] & ADXL345_PWR_CTL_MEASURE)
+        hrtimer_start(&emul->timer, adxl345_emul_period(emul), HRTIMER_MODE_REL);
+}
+
+// Pop one FIFO entry, or return the output registers when bypassed or empty
+static void adxl345_emul_pop(struct adxl345_emul *emul, u8 *raw)
+{
+    bool fifo = ADXL345_FIFO_MODE(emul->regs[ADXL345_REG_FIFO_CTL]) != ADXL345_FIFO_BYPASS;
+
+    if (fifo && emul->fifo_count) {
+        memcpy(raw, emul->fifo[emul->fifo_head], ADXL345_SAMPLE_SIZE);
+        emul->fifo_head = (emul->fifo_head + 1) % ADXL345_FIFO_DEPTH;
+        emul->fifo_count--;
+        emul->overrun = false;
+    } else {
+        memcpy(raw, emul->output, ADXL345_SAMPLE_SIZE);
+    }
+}
+
+static u8 adxl345_emul_read_one(struct adxl345_emul *emul, u8 reg)
+{
+    u8 fifo_ctl = emul->regs[ADXL345_REG_FIFO_CTL];
+    u8 val = 0;
+
+    switch (reg) {
+    case ADXL345_REG_INT_SOURCE:
+        if (emul->fifo_count || ADXL345_FIFO_MODE(fifo_ctl) == ADXL345_FIFO_BYPASS)
+            val |= ADXL345_INT_DATA_READY;
+        if (ADXL345_FIFO_MODE(fifo_ctl) != ADXL345_FIFO_BYPASS &&
+            emul->fifo_count >= ADXL345_FIFO_SAMPLES(fifo_ctl))
+            val |= ADXL345_INT_WATERMARK;
+        if (emul->overrun)
+            val |= ADXL345_INT_OVERRUN;
+        return val;
+    case ADXL345_REG_FIFO_STATUS:
+        return emul->fifo_count;
+    default:
+        return emul->regs[reg];
+    }
+}
+
+static int adxl345_emul_read_regs(void *bus, u8 reg, u8 *buf, size_t len)
+{
+    struct adxl345_emul *emul = bus;
+    unsigned long flags;
+    size_t i;
+
+    if (reg + len > ADXL345_REG_MAX + 1)
+        return -EINVAL;
+
+    spin_lock_irqsave(&emul->lock, flags);
+    // A multi-byte read starting at DATAX0 pops the FIFO once, like the real part
+    if (reg == ADXL345_REG_DATAX0 && len >= ADXL345_SAMPLE_SIZE) {
+        adxl345_emul_pop(emul, buf);
+        i = ADXL345_SAMPLE_SIZE;
+    } else {
+        i = 0;
+    }
+    for (; i < len; i++)
+        buf[i] = adxl345_emul_read_one(emul, reg + i);
+    spin_unlock_irqrestore(&emul->lock, flags);
+    return 0;
+}
+
+static int adxl345_emul_write_reg(void *bus, u8 reg, u8 val)
+{
+    struct adxl345_emul *emul = bus;
+    unsigned long flags;
+    bool raise;
+
+    if (reg > ADXL345_REG_MAX || reg == ADXL345_REG_DEVID)
+        return -EINVAL;
+
+    spin_lock_irqsave(&emul->lock, flags);
+    emul->regs[reg] = val;
+    if (reg == ADXL345_REG_FIFO_CTL && ADXL345_FIFO_MODE(val) == ADXL345_FIFO_BYPASS) {
+        emul->fifo_head = 0;
+        emul->fifo_count = 0;
+        emul->overrun = false;
+    }
+    raise = adxl345_emul_irq_pending(emul);
+    spin_unlock_irqrestore(&emul->lock, flags);
+
+    if (reg == ADXL345_REG_BW_RATE || reg == ADXL345_REG_PWR_CTL)
+        adxl345_emul_restart(emul);
+    if (raise)
+        adxl345_emul_raise(emul);
+    return 0;
+}
+
+static int adxl345_emul_burst_read(void *bus, u8 *buf, unsigned int entries)
+{
+    struct adxl345_emul *emul = bus;
+    unsigned long flags;
+    unsigned int i;
+    bool raise;
+
+    spin_lock_irqsave(&emul->lock, flags);
+    for (i = 0; i < entries; i++)
+        adxl345_emul_pop(emul, &buf[i * ADXL345_SAMPLE_SIZE]);
+    raise = adxl345_emul_irq_pending(emul);
+    spin_unlock_irqrestore(&emul->lock, flags);
+
+    if (raise)
+        adxl345_emul_raise(emul);
+    return 0;
+}
+
+static const struct adxl345_bus_ops adxl345_emul_ops = {
+    .read_regs  = adxl345_emul_read_regs,
+    .write_reg  = adxl345_emul_write_reg,
+    .burst_read = adxl345_emul_burst_read,
+};
+
+static void adxl345_emul_free_irq(struct adxl345_emul *emul)
+{
+    if (emul->irq > 0)
+        irq_dispose_mapping(emul->irq);
+    if (!IS_ERR_OR_NULL(emul->domain))
+        irq_domain_remove_sim(emul->domain);
+    if (emul->fwnode)
+        irq_domain_free_fwnode(emul->fwnode);
+}
+
+// Probe function
+static int adxl345_emul_probe(struct platform_device *pdev)
+{
+    struct adxl345_emul *emul;
+    int ret;
+
+    emul = devm_kzalloc(&pdev->dev, sizeof(*emul), GFP_KERNEL);
+    if (!emul)
+        return -ENOMEM;
+
+    spin_lock_init(&emul->lock);
+    emul->regs[ADXL345_REG_DEVID] = ADXL345_DEVID;
+    emul->regs[ADXL345_REG_BW_RATE] = ADXL345_BW_RATE_DEFAULT;
+    hrtimer_init(&emul->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    emul->timer.function = adxl345_emul_tick;
+
+    emul->fwnode = irq_domain_alloc_named_id_fwnode(DRIVER_NAME, pdev->id);
+    if (!emul->fwnode)
+        return -ENOMEM;
+    emul->domain = irq_domain_create_sim(emul->fwnode, 1);
+    if (IS_ERR(emul->domain)) {
+        ret = PTR_ERR(emul->domain);
+        goto err_irq;
+    }
+    emul->irq = irq_create_mapping(emul->domain, 0);
+    if (!emul->irq) {
+        ret = -ENXIO;
+        goto err_irq;
+    }
+
+    // Before the core probe: its IRQ and PM callbacks may run before it returns
+    platform_set_drvdata(pdev, emul);
+    emul->adxl345 = adxl345_core_probe(&pdev->dev, &adxl345_emul_ops, emul, emul->irq);
+    if (IS_ERR(emul->adxl345)) {
+        ret = PTR_ERR(emul->adxl345);
+        goto err_timer;
+    }
+    return 0;
+
+err_timer:
+    hrtimer_cancel(&emul->timer);
+err_irq:
+    adxl345_emul_free_irq(emul);
+    return ret;
+}
+
+// Remove function
+static void adxl345_emul_remove(struct platform_device *pdev)
+{
+    struct adxl345_emul *emul = platform_get_drvdata(pdev);
+
+    adxl345_core_remove(emul->adxl345);
+    hrtimer_cancel(&emul->timer);
+    adxl345_emul_free_irq(emul);
+}
+
+static struct platform_driver adxl345_emul_driver = {
+    .driver = {
+        .name = DRIVER_NAME,
+        .owner = THIS_MODULE,
+        .pm = pm_ptr(&adxl345_pm_ops),
+    },
+    .probe = adxl345_emul_probe,
+    .remove = adxl345_emul_remove,
+};
+
+static void adxl345_emul_destroy(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(emul_pdevs); i++) {
+        if (!IS_ERR_OR_NULL(emul_pdevs[i]))
+            platform_device_unregister(emul_pdevs[i]);
+        emul_pdevs[i] = NULL;
+    }
+}
+
+// Module init function
+static int __init adxl345_emul_init(void)
+{
+    unsigned int i;
+    int status;
+
+    status = platform_driver_register(&adxl345_emul_driver);
+    if (status < 0)
+        return status;
+
+    for (i = 0; i < min_t(unsigned int, sensors, N_ADXL345_MINORS); i++) {
+        emul_pdevs[i] = platform_device_register_simple(DRIVER_NAME, i, NULL, 0);
+        if (IS_ERR(emul_pdevs[i])) {
+            status = PTR_ERR(emul_pdevs[i]);
+            adxl345_emul_destroy();
+            platform_driver_unregister(&adxl345_emul_driver);
+            return status;
+        }
+    }
+    return 0;
+}
+
+// Module exit function
+static void __exit adxl345_emul_exit(void)
+{
+    adxl345_emul_destroy();
+    platform_driver_unregister(&adxl345_emul_driver);
+}
+
+module_init(adxl345_emul_init);
+module_exit(adxl345_emul_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Syaoran");
+MODULE_DESCRIPTION("Emulated ADXL345 transport for testing and benchmarks");
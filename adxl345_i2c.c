@@ -1,172 +1,132 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/i2c.h>
-#include <linux/fs.h>
-#include <linux/device.h>
 #include <linux/slab.h>
-#include <linux/mutex.h>
-#include <linux/uaccess.h>
-#include <linux/cdev.h>
-#include <linux/delay.h>
 
 #include "adxl345.h"
 
-static DECLARE_BITMAP(minors, N_I2C_MINORS);
-static struct class *adxl345_class;
-
-static LIST_HEAD(device_list);
-static DEFINE_MUTEX(device_list_lock);
-
-// Open function
-static int adxl345_open(struct inode *inode, struct file *filp) 
-{
+/*
+ * I2C transport state. The FIFO drain messages are built once at probe;
+ * a drain only points the reads at the caller's buffer. fifo_reg sits in
+ * its own cacheline so every message can be flagged DMA-safe and the
+ * adapter never has to bounce it.
+ */
+struct adxl345_i2c {
+    struct i2c_client *client;
     struct adxl345_data *adxl345;
-    int status = -ENXIO;
+    struct i2c_msg fifo_msgs[ADXL345_FIFO_DEPTH * 2];
+    unsigned int chunk;             // FIFO entries per i2c_transfer the adapter accepts
+    u8 fifo_reg ____cacheline_aligned;
+};
 
-    mutex_lock(&device_list_lock);
+static int adxl345_i2c_read_regs(void *bus, u8 reg, u8 *buf, size_t len)
+{
+    struct adxl345_i2c *adxl345_i2c = bus;
+    int ret;
 
-    list_for_each_entry(adxl345, &device_list, device_entry) 
-    {
-        if (adxl345->devt == inode->i_rdev) 
-        {
-            adxl345->users++;
-            filp->private_data = adxl345;
-            nonseekable_open(inode, filp);
-            status = 0;
-            break;
-        }
-    }
-    mutex_unlock(&device_list_lock);
-    return status;
+    ret = i2c_smbus_read_i2c_block_data(adxl345_i2c->client, reg, len, buf);
+    if (ret < 0)
+        return ret;
+    return ret == len ? 0 : -EIO;
 }
 
-// Release function
-static int adxl345_release(struct inode *inode, struct file *filp) 
+static int adxl345_i2c_write_reg(void *bus, u8 reg, u8 val)
 {
-    struct adxl345_data *adxl345 = filp->private_data;
+    struct adxl345_i2c *adxl345_i2c = bus;
 
-    mutex_lock(&device_list_lock);
-    adxl345->users--;
-    mutex_unlock(&device_list_lock);
-
-    return 0;
+    return i2c_smbus_write_byte_data(adxl345_i2c->client, reg, val);
 }
 
-// Write function
-static ssize_t adxl345_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos) 
+/*
+ * Each FIFO entry pops on its own 6-byte read; chain as many as the adapter
+ * takes into one i2c_transfer. Some adapters (i2c-bcm2835 among them) only
+ * accept a read as the last message and say so with -EOPNOTSUPP before
+ * anything goes on the wire; those get one write+read pair per transfer.
+ */
+static int adxl345_i2c_burst_read(void *bus, u8 *buf, unsigned int entries)
 {
-    struct adxl345_data *adxl345 = filp->private_data;
-    ssize_t status = 0;
-
-    if (count > 4096)
-        return -ENOMEM;
-
-    if (copy_from_user(adxl345->tx_buffer, buf, count))
-        return -EFAULT;
-
-    mutex_lock(&adxl345->buf_lock);
-    status = i2c_master_send(adxl345->client, adxl345->tx_buffer, count);
-    mutex_unlock(&adxl345->buf_lock);
+    struct adxl345_i2c *adxl345_i2c = bus;
+    struct i2c_client *client = adxl345_i2c->client;
+    struct i2c_msg *msgs = adxl345_i2c->fifo_msgs;
+    unsigned int i, n;
+    int ret;
 
-    return status;
+    for (i = 0; i < entries; i++)
+        msgs[2 * i + 1].buf = &buf[i * ADXL345_SAMPLE_SIZE];
+
+    for (i = 0; i < entries; i += n) {
+        n = min(entries - i, adxl345_i2c->chunk);
+        ret = i2c_transfer(client->adapter, &msgs[2 * i], n * 2);
+        if (ret == -EOPNOTSUPP && n > 1) {
+            dev_info(&client->dev, "adapter rejects chained reads, draining one entry at a time\n");
+            adxl345_i2c->chunk = 1;
+            n = 0;
+            continue;
+        }
+        if (ret < 0)
+            return ret;
+        if (ret != n * 2)
+            return -EIO;
+    }
+    return 0;
 }
 
-// IOCTL function
-static long adxl345_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+static void adxl345_i2c_init_msgs(struct adxl345_i2c *adxl345_i2c)
 {
-    struct adxl345_data *adxl345;
-    int status = 0;
-
-    if (_IOC_TYPE(cmd) != ADXL345_IOC_MAGIC)
-        return -ENOTTY;
-
-    adxl345 = filp->private_data;
-
-    if (_IOC_NR(cmd) > ADXL345_IOC_MAXNR) 
-        return -ENOTTY;
-
-    switch (cmd) {
-        case ADXL345_IOC_SET_RANGE:
-            // if (arg > 0x03) return -EINVAL;
-            // mutex_lock(&adxl345->buf_lock);
-            // // adxl345_send_command(adxl345, 0x31); // Set range command
-            // // adxl345_send_command(adxl345, (__u8)arg);
-            // mutex_unlock(&adxl345->buf_lock);
-            break;
-
-        default:
-            return -ENOTTY;
+    struct i2c_msg *msgs = adxl345_i2c->fifo_msgs;
+    u16 addr = adxl345_i2c->client->addr;
+    const struct i2c_adapter_quirks *quirks = adxl345_i2c->client->adapter->quirks;
+    unsigned int i;
+
+    adxl345_i2c->chunk = ADXL345_FIFO_DEPTH;
+    if (quirks && quirks->max_num_msgs)
+        adxl345_i2c->chunk = clamp_t(int, quirks->max_num_msgs / 2, 1, ADXL345_FIFO_DEPTH);
+
+    adxl345_i2c->fifo_reg = ADXL345_REG_DATAX0;
+    for (i = 0; i < ADXL345_FIFO_DEPTH; i++) {
+        msgs[2 * i].addr = addr;
+        msgs[2 * i].flags = I2C_M_DMA_SAFE;
+        msgs[2 * i].len = 1;
+        msgs[2 * i].buf = &adxl345_i2c->fifo_reg;
+        msgs[2 * i + 1].addr = addr;
+        msgs[2 * i + 1].flags = I2C_M_RD | I2C_M_DMA_SAFE;
+        msgs[2 * i + 1].len = ADXL345_SAMPLE_SIZE;
     }
-
-    return status;
 }
 
-// File operations structure
-static const struct file_operations adxl345_fops = {
-    .owner = THIS_MODULE,
-    .open = adxl345_open,
-    .release = adxl345_release,
-    .write = adxl345_write,
-    .unlocked_ioctl = adxl345_ioctl,
-    .llseek = no_llseek,
+static const struct adxl345_bus_ops adxl345_i2c_ops = {
+    .read_regs  = adxl345_i2c_read_regs,
+    .write_reg  = adxl345_i2c_write_reg,
+    .burst_read = adxl345_i2c_burst_read,
 };
 
 // Probe function
-static int adxl345_probe(struct i2c_client *client, const struct i2c_device_id *id) 
+static int adxl345_probe(struct i2c_client *client) 
 {
-    struct adxl345_data *adxl345;
-    int status;
-    unsigned long minor;
-    struct device *dev;
+    struct adxl345_i2c *adxl345_i2c;
 
-    adxl345 = kzalloc(sizeof(*adxl345), GFP_KERNEL);
-    if (!adxl345)
+    adxl345_i2c = devm_kzalloc(&client->dev, sizeof(*adxl345_i2c), GFP_KERNEL);
+    if (!adxl345_i2c)
         return -ENOMEM;
 
-    adxl345->client = client;
-    mutex_init(&adxl345->buf_lock);
-    INIT_LIST_HEAD(&adxl345->device_entry);
-
-    minor = find_first_zero_bit(minors, N_I2C_MINORS);
-    if (minor < N_I2C_MINORS) {
-        set_bit(minor, minors);
-        adxl345->devt = MKDEV(ADXL345_MAJOR, minor);
-        dev = device_create(adxl345_class, &client->dev, adxl345->devt, adxl345, "adxl345_i2c%d", minor);
-        status = IS_ERR(dev) ? PTR_ERR(dev) : 0;
-    } else {
-        dev_dbg(&client->dev, "no minor number available!\n");
-        status = -ENODEV;
-    }
+    adxl345_i2c->client = client;
+    adxl345_i2c_init_msgs(adxl345_i2c);
+    // Before the core probe: its IRQ and PM callbacks may run before it returns
+    i2c_set_clientdata(client, adxl345_i2c);
 
-    if (status == 0) {
-        list_add(&adxl345->device_entry, &device_list);
-        i2c_set_clientdata(client, adxl345);
-    } else {
-        kfree(adxl345);
-    }
-
-    return status;
+    adxl345_i2c->adxl345 = adxl345_core_probe(&client->dev, &adxl345_i2c_ops, adxl345_i2c,
+                                              client->irq);
+    if (IS_ERR(adxl345_i2c->adxl345))
+        return PTR_ERR(adxl345_i2c->adxl345);
+    return 0;
 }
 
 // Remove function
 static void adxl345_remove(struct i2c_client *client)
 {
-    struct adxl345_data *adxl345 = i2c_get_clientdata(client);
+    struct adxl345_i2c *adxl345_i2c = i2c_get_clientdata(client);
 
-    // Prevent new opens
-    mutex_lock(&device_list_lock);
-    // Make sure ops on existing fds can abort cleanly
-    mutex_lock(&adxl345->i2c_lock);
-    adxl345->client = NULL;
-    mutex_unlock(&adxl345->i2c_lock);
-
-    list_del(&adxl345->device_entry);
-    device_destroy(adxl345_class, adxl345->devt);
-    clear_bit(MINOR(adxl345->devt), minors);
-    if (adxl345->users == 0)
-        kfree(adxl345);
-
-    mutex_unlock(&device_list_lock);
+    adxl345_core_remove(adxl345_i2c->adxl345);
 }
 
 // I2C driver structure
@@ -176,86 +136,27 @@ static const struct i2c_device_id adxl345_id[] = {
 };
 MODULE_DEVICE_TABLE(i2c, adxl345_id);
 
+static const struct of_device_id adxl345_of_match[] = {
+    { .compatible = "analog,adxl345", },
+    { },
+};
+MODULE_DEVICE_TABLE(of, adxl345_of_match);
+
 static struct i2c_driver adxl345_driver = {
     .driver = {
-        .name = "adxl345",
+        .name = "adxl345_i2c",
         .owner = THIS_MODULE,
+        .of_match_table = of_match_ptr(adxl345_of_match),
+        .pm = pm_ptr(&adxl345_pm_ops),
     },
     .probe = adxl345_probe,
     .remove = adxl345_remove,
     .id_table = adxl345_id,
 };
 
-// Send command function
-static int adxl345_send_command(struct adxl345_data *adxl345, u8 command) {
-    int ret;
-
-    mutex_lock(&adxl345->i2c_lock);
-    if (!adxl345->client) {
-        mutex_unlock(&adxl345->i2c_lock);
-        return -ENODEV;
-    }
-
-    ret = i2c_master_send(adxl345->client, &command, 1);
-    mutex_unlock(&adxl345->i2c_lock);
-
-    return ret;
-}
-
-// Send data function
-static int adxl345_send_data(struct adxl345_data *adxl345, const u8 *data, size_t len) {
-    int ret;
-
-    mutex_lock(&adxl345->i2c_lock);
-    if (!adxl345->client) {
-        mutex_unlock(&adxl345->i2c_lock);
-        return -ENODEV;
-    }
-
-    ret = i2c_master_send(adxl345->client, data, len);
-    mutex_unlock(&adxl345->i2c_lock);
-
-    return ret;
-}
-
-// Module init function
-static int __init adxl345_init(void) 
-{
-    int status;
-    printk(KERN_INFO "Initiate ADXL345 I2C Driver.\n");
-    adxl345_class = class_create(THIS_MODULE, "adxl345_driver");
-    if (IS_ERR(adxl345_class)) {
-        return PTR_ERR(adxl345_class);
-    }
-
-    status = register_chrdev(ADXL345_MAJOR, "adxl345_driver", &adxl345_fops);
-    if (status < 0) {
-        class_destroy(adxl345_class);
-        return status;
-    }
-
-    status = i2c_add_driver(&adxl345_driver);
-    if (status < 0) {
-        unregister_chrdev(ADXL345_MAJOR, adxl345_driver.driver.name);
-        class_destroy(adxl345_class);
-    }
-
-    return status;
-}
-
-// Module exit function
-static void __exit adxl345_exit(void) 
-{
-    i2c_del_driver(&adxl345_driver);
-    unregister_chrdev(ADXL345_MAJOR, adxl345_driver.driver.name);
-    class_destroy(adxl345_class);
-}
-
-module_init(adxl345_init);
-module_exit(adxl345_exit);
+module_i2c_driver(adxl345_driver);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Your Name");
 MODULE_DESCRIPTION("ADXL345 I2C Driver");
 MODULE_VERSION("1.0");
-
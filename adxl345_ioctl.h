@@ -0,0 +1,229 @@
+#ifndef ADXL345_IOCTL_H
+#define ADXL345_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// One coherent sample: all three axes come from the same DATAX0..DATAZ1 burst
+struct adxl345_sample {
+    __s16 x;
+    __s16 y;
+    __s16 z;
+    __u16 flags;            // ADXL345_SAMPLE_* bits
+    __s64 timestamp_ns;     // Sampling instant (see the timestamp_clock sysfs attribute)
+};
+
+// Samples were lost (hardware FIFO or driver buffer overrun) right before this one
+#define ADXL345_SAMPLE_OVERRUN  0x0001
+// First sample at a new output data rate (reconfiguration or autosleep)
+#define ADXL345_SAMPLE_RATE_CHANGE 0x0002
+
+/*
+ * mmap() of the device returns this control page followed by the sample
+ * ring: ring[i & (size - 1)] lives at data_offset + i * sizeof(struct adxl345_sample).
+ * The driver advances head (store-release) after filling slots; an mmap
+ * consumer reads head with acquire semantics, processes samples in place
+ * and then advances tail. All mappings of a device share this one tail;
+ * every read() file has a cursor of its own (see ADXL345_IOCTL_SET_READER).
+ */
+struct adxl345_ring_ctrl {
+    __u32 head;             // Written by the driver
+    __u32 tail;             // Written by the consumer
+    __u32 size;             // Sample slots, power of two
+    __u32 data_offset;      // Byte offset of slot 0 in the mapping
+    __u64 mmap_size;        // Length to pass to mmap() for the whole ring
+    __u64 overruns;         // Samples dropped because the ring was full
+};
+
+// Group device (/dev/adxl345_group): one frame per read record, all sensors sampled together
+struct adxl345_axes {
+    __s16 x;
+    __s16 y;
+    __s16 z;
+};
+
+struct adxl345_frame {
+    __s64 timestamp_ns;     // Shared by every sensor in the frame
+    __u16 count;            // Number of axes[] entries
+    __u16 flags;            // ADXL345_SAMPLE_OVERRUN if a member had to drop samples to align
+    __u32 reserved;
+    struct adxl345_axes axes[];     // Ordered by member minor number
+};
+
+// Bytes taken by one frame of n sensors, padded so frames stay 8-byte aligned
+#define ADXL345_FRAME_SIZE(n) \
+    ((sizeof(struct adxl345_frame) + (n) * sizeof(struct adxl345_axes) + 7) & ~7UL)
+
+struct adxl345_group_config {
+    __u32 members;          // Bitmask of sensor minors (0 is /dev/adxl345, N is /dev/adxl345-N)
+    __u32 tolerance_ns;     // Samples further apart than this are not put in one frame
+};
+
+// Measurement setup; changes are applied while streaming without losing the stream
+struct adxl345_config {
+    __u32 range_g;          // 2, 4, 8 or 16
+    __u32 rate;             // BW_RATE code: 0x0F is 3200 Hz, each step down halves it
+    __u32 flags;            // ADXL345_CONFIG_* bits
+};
+
+#define ADXL345_CONFIG_FULL_RES     0x0001  // 3.9 mg/LSB at every range instead of 10 bits
+#define ADXL345_CONFIG_LOW_POWER    0x0002  // Less current, more noise; rates 12.5-400 Hz only
+
+// Size of one LSB for the current configuration; value = raw * scale
+struct adxl345_scale {
+    __u32 ug_per_lsb;       // Micro-g
+    __u32 nms2_per_lsb;     // Nano-m/s^2 (standard gravity 9.80665 m/s^2)
+};
+
+// Optional CIC decimation of the read()/mmap()/group stream (IIO keeps the full rate)
+struct adxl345_decimation {
+    __u32 ratio;            // 1 (off) or a power of two up to ADXL345_DECIMATION_MAX
+    __u32 order;            // CIC stages 1-4: more stages reject aliases better but delay more
+};
+
+#define ADXL345_DECIMATION_MAX  64
+
+/*
+ * On-chip motion detection. Each enabled engine raises an interrupt that is
+ * queued as a struct adxl345_event, independently of sample streaming:
+ * poll() reports EPOLLPRI and ADXL345_IOCTL_READ_EVENT dequeues one.
+ */
+#define ADXL345_EVENT_SINGLE_TAP    0x40
+#define ADXL345_EVENT_DOUBLE_TAP    0x20
+#define ADXL345_EVENT_ACTIVITY      0x10
+#define ADXL345_EVENT_INACTIVITY    0x08
+#define ADXL345_EVENT_FREE_FALL     0x04
+#define ADXL345_EVENT_ALL           0x7C
+
+#define ADXL345_AXIS_X              0x4
+#define ADXL345_AXIS_Y              0x2
+#define ADXL345_AXIS_Z              0x1
+
+#define ADXL345_EVENT_CFG_AC_ACTIVITY   0x0001  // Compare against the level at activity start
+#define ADXL345_EVENT_CFG_AC_INACTIVITY 0x0002
+#define ADXL345_EVENT_CFG_TAP_SUPPRESS  0x0004  // Reject double taps with motion in the latency gap
+
+// Thresholds are rounded to 62.5 mg steps and times to the register resolution
+struct adxl345_event_config {
+    __u32 enable;           // ADXL345_EVENT_* bits
+    __u32 flags;            // ADXL345_EVENT_CFG_* bits
+    __u32 act_axes;         // ADXL345_AXIS_* bits taking part in (in)activity
+    __u32 tap_axes;         // ADXL345_AXIS_* bits taking part in tap detection
+    __u32 act_thresh_mg;
+    __u32 inact_thresh_mg;
+    __u32 inact_time_s;     // Up to 255 s below inact_thresh_mg
+    __u32 ff_thresh_mg;     // All axes below this ...
+    __u32 ff_time_ms;       // ... for this long (5 ms steps, up to 1275 ms)
+    __u32 tap_thresh_mg;
+    __u32 tap_dur_us;       // Max tap duration (625 us steps)
+    __u32 tap_latent_us;    // Double tap: quiet time after the first tap (1250 us steps)
+    __u32 tap_window_us;    // Double tap: window for the second tap (1250 us steps)
+};
+
+struct adxl345_event {
+    __s64 timestamp_ns;     // Time the interrupt was taken
+    __u32 type;             // One ADXL345_EVENT_* bit
+    __u32 axes;             // ADXL345_AXIS_* bits that triggered activity or a tap
+};
+
+/*
+ * read() format. ADXL345_FORMAT_SAMPLE returns struct adxl345_sample
+ * records. ADXL345_FORMAT_PACKED returns 6-byte struct adxl345_axes
+ * records without timestamps, with a struct adxl345_anchor (three records
+ * long, x == ADXL345_PACKED_MARKER) in front of the first sample, every
+ * anchor_interval samples, before any flagged sample and wherever the
+ * timestamps stop following the anchor's period. Sample n after an anchor
+ * was taken at timestamp_ns + n * period_ns. read() returns whole records.
+ */
+#define ADXL345_FORMAT_SAMPLE   0
+#define ADXL345_FORMAT_PACKED   1
+
+struct adxl345_format {
+    __u32 format;           // ADXL345_FORMAT_*
+    __u32 anchor_interval;  // Packed: samples between periodic anchors, 0 for discontinuities only
+};
+
+#define ADXL345_ANCHOR_INTERVAL_DEFAULT 256
+
+// Never produced by the sensor: data is at most 13 bits wide
+#define ADXL345_PACKED_MARKER   (-32768)
+
+struct adxl345_anchor {
+    __s16 marker;           // ADXL345_PACKED_MARKER
+    __u16 flags;            // ADXL345_SAMPLE_* bits of the sample that follows
+    __u32 period_ns;        // Spacing of the samples up to the next anchor
+    __s64 timestamp_ns;     // Sampling instant of the sample that follows
+    __u16 reserved;
+} __attribute__((packed));
+
+#define ADXL345_ANCHOR_RECORDS  (sizeof(struct adxl345_anchor) / sizeof(struct adxl345_axes))
+
+/*
+ * What happens to a read() file that falls a whole ring behind the others.
+ * BLOCK holds the ring back: once it is full, new samples are dropped for
+ * every consumer (ring overruns). SKIP moves only this file's cursor
+ * forward; its next sample carries ADXL345_SAMPLE_OVERRUN. DETACH stops
+ * delivering to the file: read() fails with EPIPE until SET_READER is
+ * issued again, which restarts it at the newest sample.
+ */
+#define ADXL345_READER_BLOCK    0
+#define ADXL345_READER_SKIP     1
+#define ADXL345_READER_DETACH   2
+
+struct adxl345_reader_config {
+    __u32 policy;           // ADXL345_READER_*
+    __u32 reserved;
+    __u64 dropped;          // GET only: samples this file lost to SKIP or DETACH
+};
+
+/*
+ * Polled FIFO drain for boards without an interrupt line: one READ_FIFO
+ * reads FIFO_STATUS and empties the FIFO with a single burst. The first
+ * call switches the FIFO to stream mode (no interrupts are raised) and the
+ * last close() turns it off again. Not available while samples stream to
+ * read(), mmap() or the IIO buffer. Call at least every 32 sample periods.
+ */
+struct adxl345_fifo_read {
+    __u64 samples;          // User pointer to max struct adxl345_sample
+    __u32 max;              // Capacity of samples; at most ADXL345_FIFO_READ_MAX are used
+    __u32 count;            // Returned: samples stored, oldest first
+    __u32 flags;            // Returned: ADXL345_FIFO_READ_* bits
+    __u32 pending;          // Returned: entries left in the FIFO because max was too small
+};
+
+#define ADXL345_FIFO_READ_MAX       32
+/*
+ * INT_SOURCE had the overrun bit set when the call looked: the FIFO filled
+ * up and unread entries were overwritten since it was last drained, here
+ * or by a stream. The sensor latches the bit until FIFO entries are read,
+ * so each overrun is reported by one call only.
+ */
+#define ADXL345_FIFO_READ_OVERFLOW  0x0001
+
+// List of ioctl command
+#define ADXL345_IOCTL_MAGIC 'a'
+// READ_X/Y/Z return whole m/s^2 (rounded); use READ_XYZ and GET_SCALE for full precision
+#define ADXL345_IOCTL_READ_X _IOR(ADXL345_IOCTL_MAGIC, 1, int)
+#define ADXL345_IOCTL_READ_Y _IOR(ADXL345_IOCTL_MAGIC, 2, int)
+#define ADXL345_IOCTL_READ_Z _IOR(ADXL345_IOCTL_MAGIC, 3, int)
+#define ADXL345_IOCTL_READ_XYZ _IOR(ADXL345_IOCTL_MAGIC, 4, struct adxl345_sample)
+// poll()/read() wake up only once this many samples are buffered (default 1)
+#define ADXL345_IOCTL_SET_WAKEUP _IOW(ADXL345_IOCTL_MAGIC, 5, __u32)
+// Group device only: choose the sensors merged into this fd's frames
+#define ADXL345_IOCTL_GROUP_SET _IOW(ADXL345_IOCTL_MAGIC, 6, struct adxl345_group_config)
+#define ADXL345_IOCTL_GET_CONFIG _IOR(ADXL345_IOCTL_MAGIC, 7, struct adxl345_config)
+#define ADXL345_IOCTL_SET_CONFIG _IOW(ADXL345_IOCTL_MAGIC, 8, struct adxl345_config)
+#define ADXL345_IOCTL_GET_SCALE _IOR(ADXL345_IOCTL_MAGIC, 9, struct adxl345_scale)
+#define ADXL345_IOCTL_SET_DECIMATION _IOW(ADXL345_IOCTL_MAGIC, 10, struct adxl345_decimation)
+#define ADXL345_IOCTL_GET_DECIMATION _IOR(ADXL345_IOCTL_MAGIC, 11, struct adxl345_decimation)
+#define ADXL345_IOCTL_SET_EVENTS _IOW(ADXL345_IOCTL_MAGIC, 12, struct adxl345_event_config)
+#define ADXL345_IOCTL_GET_EVENTS _IOR(ADXL345_IOCTL_MAGIC, 13, struct adxl345_event_config)
+// Blocks for the next event unless the fd is O_NONBLOCK
+#define ADXL345_IOCTL_READ_EVENT _IOR(ADXL345_IOCTL_MAGIC, 14, struct adxl345_event)
+#define ADXL345_IOCTL_SET_FORMAT _IOW(ADXL345_IOCTL_MAGIC, 15, struct adxl345_format)
+#define ADXL345_IOCTL_GET_FORMAT _IOR(ADXL345_IOCTL_MAGIC, 16, struct adxl345_format)
+#define ADXL345_IOCTL_SET_READER _IOW(ADXL345_IOCTL_MAGIC, 17, struct adxl345_reader_config)
+#define ADXL345_IOCTL_GET_READER _IOR(ADXL345_IOCTL_MAGIC, 18, struct adxl345_reader_config)
+#define ADXL345_IOCTL_READ_FIFO _IOWR(ADXL345_IOCTL_MAGIC, 19, struct adxl345_fifo_read)
+
+#endif // ADXL345_IOCTL_H
@@ -1,275 +1,348 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/spi/spi.h>
-#include <linux/fs.h>
-#include <linux/device.h>
 #include <linux/slab.h>
-#include <linux/mutex.h>
-#include <linux/uaccess.h>
-#include <linux/cdev.h>
-#include <linux/delay.h>
-#include <linux/gpio.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
 
 #include "adxl345.h"
 
-static DECLARE_BITMAP(minors, N_SPI_MINORS);
-static struct class *adxl345_class;
+#define ADXL345_SPI_READ    BIT(7)
+#define ADXL345_SPI_MB      BIT(6)  // Multi-byte: auto-increment the address
 
-static LIST_HEAD(device_list);
-static DEFINE_MUTEX(device_list_lock);
+#define ADXL345_SPI_ENTRY_LEN   (1 + ADXL345_SAMPLE_SIZE)  // Command byte + DATAX0..DATAZ1
+#define ADXL345_SPI_REGS_LEN    (1 + ADXL345_REG_MAX + 1)
 
-// Open function
-static int adxl345_open(struct inode *inode, struct file *filp) 
-{
+static bool use_async = true;
+module_param_named(async, use_async, bool, 0444);
+MODULE_PARM_DESC(async, "Drain the FIFO with spi_async() from the IRQ instead of a threaded IRQ");
+
+struct adxl345_spi;
+
+/*
+ * One half of the async double buffer: a FIFO drain of up to
+ * ADXL345_FIFO_DEPTH entries followed by reads of INT_SOURCE and
+ * FIFO_STATUS, so the completion knows whether to chain the other half.
+ */
+struct adxl345_spi_slot {
+    struct adxl345_spi *adxl345_spi;
+    struct spi_message msg;
+    struct spi_transfer xfers[ADXL345_FIFO_DEPTH];
+    struct spi_transfer status_xfers[2];
+    unsigned int entries;
+    s64 timestamp;
+
+    u8 status_tx[2][2] ____cacheline_aligned;
+    u8 status_rx[2][2] ____cacheline_aligned;
+    u8 rx[ADXL345_FIFO_DEPTH][ADXL345_SPI_ENTRY_LEN] ____cacheline_aligned;
+    u8 raw[ADXL345_FIFO_DEPTH * ADXL345_SAMPLE_SIZE];
+};
+
+/*
+ * SPI transport state. Every spi_message and spi_transfer is set up once
+ * at probe and reused, and all buffers handed to the controller sit in
+ * their own cachelines at the end of this kmalloc'd struct so they are
+ * DMA-safe.
+ */
+struct adxl345_spi {
+    struct spi_device *spi;
     struct adxl345_data *adxl345;
-    int status = -ENXIO;
-
-    mutex_lock(&device_list_lock);
-
-    list_for_each_entry(adxl345, &device_list, device_entry) 
-    {
-        if (adxl345->devt == inode->i_rdev) 
-        {
-            adxl345->users++;
-            filp->private_data = adxl345;
-            nonseekable_open(inode, filp);
-            status = 0;
-            break;
-        }
+
+    struct spi_message reg_msg;
+    struct spi_transfer reg_xfer;
+    // FIFO drain: one full-duplex transfer per entry, CS released in between
+    struct spi_message fifo_msg;
+    struct spi_transfer fifo_xfers[ADXL345_FIFO_DEPTH];
+
+    // Async pipeline: slots alternate, push_lock keeps their samples in order
+    struct adxl345_spi_slot slots[2];
+    unsigned int next_slot;
+    spinlock_t push_lock;
+    atomic_t inflight;
+    wait_queue_head_t flush_wait;
+
+    u8 reg_tx[ADXL345_SPI_REGS_LEN] ____cacheline_aligned;
+    u8 reg_rx[ADXL345_SPI_REGS_LEN] ____cacheline_aligned;
+    u8 fifo_tx[ADXL345_SPI_ENTRY_LEN] ____cacheline_aligned;
+    u8 fifo_rx[ADXL345_FIFO_DEPTH][ADXL345_SPI_ENTRY_LEN] ____cacheline_aligned;
+};
+
+static void adxl345_spi_complete(void *context);
+
+static void adxl345_spi_init_slot(struct adxl345_spi *adxl345_spi, struct adxl345_spi_slot *slot)
+{
+    struct spi_transfer *xfer;
+    unsigned int i;
+
+    slot->adxl345_spi = adxl345_spi;
+    for (i = 0; i < ADXL345_FIFO_DEPTH; i++) {
+        xfer = &slot->xfers[i];
+        xfer->tx_buf = adxl345_spi->fifo_tx;
+        xfer->rx_buf = slot->rx[i];
+        xfer->len = ADXL345_SPI_ENTRY_LEN;
+        xfer->cs_change = 1;
+        xfer->cs_change_delay.value = 5;
+        xfer->cs_change_delay.unit = SPI_DELAY_UNIT_USECS;
     }
-    mutex_unlock(&device_list_lock);
-    return status;
+
+    slot->status_tx[0][0] = ADXL345_REG_INT_SOURCE | ADXL345_SPI_READ;
+    slot->status_tx[1][0] = ADXL345_REG_FIFO_STATUS | ADXL345_SPI_READ;
+    for (i = 0; i < 2; i++) {
+        xfer = &slot->status_xfers[i];
+        xfer->tx_buf = slot->status_tx[i];
+        xfer->rx_buf = slot->status_rx[i];
+        xfer->len = 2;
+    }
+    slot->status_xfers[0].cs_change = 1;
+
+    spi_message_init(&slot->msg);
+    slot->msg.complete = adxl345_spi_complete;
+    slot->msg.context = slot;
 }
 
-// Release function
-static int adxl345_release(struct inode *inode, struct file *filp) 
+static void adxl345_spi_init_msgs(struct adxl345_spi *adxl345_spi)
 {
-    struct adxl345_data *adxl345 = filp->private_data;
+    struct spi_transfer *xfer;
+    unsigned int i;
+
+    adxl345_spi->reg_xfer.tx_buf = adxl345_spi->reg_tx;
+    adxl345_spi->reg_xfer.rx_buf = adxl345_spi->reg_rx;
+    spi_message_init_with_transfers(&adxl345_spi->reg_msg, &adxl345_spi->reg_xfer, 1);
+
+    // Every entry sends the same multi-byte read of DATAX0; the rest is dummy clocks
+    adxl345_spi->fifo_tx[0] = ADXL345_REG_DATAX0 | ADXL345_SPI_READ | ADXL345_SPI_MB;
+    for (i = 0; i < ADXL345_FIFO_DEPTH; i++) {
+        xfer = &adxl345_spi->fifo_xfers[i];
+        xfer->tx_buf = adxl345_spi->fifo_tx;
+        xfer->rx_buf = adxl345_spi->fifo_rx[i];
+        xfer->len = ADXL345_SPI_ENTRY_LEN;
+        // The FIFO needs CS high for 5 us before the next entry can be read
+        xfer->cs_change = 1;
+        xfer->cs_change_delay.value = 5;
+        xfer->cs_change_delay.unit = SPI_DELAY_UNIT_USECS;
+    }
+    spi_message_init_with_transfers(&adxl345_spi->fifo_msg, adxl345_spi->fifo_xfers,
+                                    ADXL345_FIFO_DEPTH);
+
+    spin_lock_init(&adxl345_spi->push_lock);
+    atomic_set(&adxl345_spi->inflight, 0);
+    init_waitqueue_head(&adxl345_spi->flush_wait);
+    for (i = 0; i < ARRAY_SIZE(adxl345_spi->slots); i++)
+        adxl345_spi_init_slot(adxl345_spi, &adxl345_spi->slots[i]);
+}
 
-    mutex_lock(&device_list_lock);
-    adxl345->users--;
-    mutex_unlock(&device_list_lock);
+static int adxl345_spi_read_regs(void *bus, u8 reg, u8 *buf, size_t len)
+{
+    struct adxl345_spi *adxl345_spi = bus;
+    int ret;
+
+    if (len + 1 > ADXL345_SPI_REGS_LEN)
+        return -EINVAL;
+
+    adxl345_spi->reg_tx[0] = reg | ADXL345_SPI_READ | (len > 1 ? ADXL345_SPI_MB : 0);
+    memset(&adxl345_spi->reg_tx[1], 0, len);
+    adxl345_spi->reg_xfer.len = len + 1;
+    ret = spi_sync(adxl345_spi->spi, &adxl345_spi->reg_msg);
+    if (ret < 0)
+        return ret;
 
+    memcpy(buf, &adxl345_spi->reg_rx[1], len);
     return 0;
 }
 
-// Write function
-static ssize_t adxl345_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos) 
+static int adxl345_spi_write_reg(void *bus, u8 reg, u8 val)
 {
-    struct adxl345_data *adxl345 = filp->private_data;
-    ssize_t status = 0;
+    struct adxl345_spi *adxl345_spi = bus;
 
-    if (count > 4096)
-        return -ENOMEM;
+    adxl345_spi->reg_tx[0] = reg;
+    adxl345_spi->reg_tx[1] = val;
+    adxl345_spi->reg_xfer.len = 2;
+    return spi_sync(adxl345_spi->spi, &adxl345_spi->reg_msg);
+}
 
-    if (copy_from_user(adxl345->tx_buffer, buf, count))
-        return -EFAULT;
+/*
+ * Drain entries samples in one spi_sync(). The message always carries all
+ * ADXL345_FIFO_DEPTH transfers; only the list is trimmed to the first
+ * entries transfers, so nothing is allocated or rebuilt per call.
+ */
+static int adxl345_spi_burst_read(void *bus, u8 *buf, unsigned int entries)
+{
+    struct adxl345_spi *adxl345_spi = bus;
+    struct spi_message *msg = &adxl345_spi->fifo_msg;
+    struct spi_transfer *last = &adxl345_spi->fifo_xfers[entries - 1];
+    unsigned int i;
+    int ret;
+
+    // Relink so the transfer list ends at the last wanted entry
+    INIT_LIST_HEAD(&msg->transfers);
+    for (i = 0; i < entries; i++)
+        list_add_tail(&adxl345_spi->fifo_xfers[i].transfer_list, &msg->transfers);
 
-    mutex_lock(&adxl345->buf_lock);
-    status = spi_write(adxl345->spi, adxl345->tx_buffer, count);
-    mutex_unlock(&adxl345->buf_lock);
+    last->cs_change = 0;
+    ret = spi_sync(adxl345_spi->spi, msg);
+    last->cs_change = 1;
+    if (ret < 0)
+        return ret;
 
-    return status;
+    for (i = 0; i < entries; i++)
+        memcpy(&buf[i * ADXL345_SAMPLE_SIZE], &adxl345_spi->fifo_rx[i][1], ADXL345_SAMPLE_SIZE);
+    return 0;
 }
 
-// IOCTL function
-static long adxl345_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+// Queue the next slot; never sleeps, so it works from hard IRQ and completion context
+static int adxl345_spi_submit(struct adxl345_spi *adxl345_spi, unsigned int entries, s64 timestamp)
 {
-    struct adxl345_data *adxl345;
-    int status = 0;
+    struct adxl345_spi_slot *slot = &adxl345_spi->slots[adxl345_spi->next_slot];
+    unsigned int i;
+    int ret;
 
-    if (_IOC_TYPE(cmd) != ADXL345_IOC_MAGIC)
-        return -ENOTTY;
+    INIT_LIST_HEAD(&slot->msg.transfers);
+    for (i = 0; i < entries; i++)
+        list_add_tail(&slot->xfers[i].transfer_list, &slot->msg.transfers);
+    list_add_tail(&slot->status_xfers[0].transfer_list, &slot->msg.transfers);
+    list_add_tail(&slot->status_xfers[1].transfer_list, &slot->msg.transfers);
+    slot->entries = entries;
+    slot->timestamp = timestamp;
+
+    atomic_inc(&adxl345_spi->inflight);
+    ret = spi_async(adxl345_spi->spi, &slot->msg);
+    if (ret < 0) {
+        if (atomic_dec_and_test(&adxl345_spi->inflight))
+            wake_up(&adxl345_spi->flush_wait);
+        return ret;
+    }
+    adxl345_spi->next_slot ^= 1;
+    return 0;
+}
 
-    adxl345 = filp->private_data;
+static int adxl345_spi_drain_async(void *bus, unsigned int entries, s64 timestamp)
+{
+    return adxl345_spi_submit(bus, entries, timestamp);
+}
 
-    if (_IOC_NR(cmd) > ADXL345_IOC_MAXNR) 
-        return -ENOTTY;
+/*
+ * Completion of one slot. If the FIFO still holds a full batch, the other
+ * slot is queued before this one is decoded so the bus stays busy while
+ * the CPU copies samples into the ring. push_lock is taken first so the
+ * chained slot cannot publish its samples ahead of ours.
+ */
+static void adxl345_spi_complete(void *context)
+{
+    struct adxl345_spi_slot *slot = context;
+    struct adxl345_spi *adxl345_spi = slot->adxl345_spi;
+    struct adxl345_data *adxl345 = adxl345_spi->adxl345;
+    unsigned int remaining = ADXL345_FIFO_ENTRIES(slot->status_rx[1][1]);
+    bool chained = false;
+    unsigned long flags;
+    unsigned int i;
+
+    spin_lock_irqsave(&adxl345_spi->push_lock, flags);
+    if (slot->msg.status == 0) {
+        if (remaining >= slot->entries)
+            chained = adxl345_spi_submit(adxl345_spi, slot->entries,
+                                         adxl345_core_timestamp(adxl345)) == 0;
+
+        for (i = 0; i < slot->entries; i++)
+            memcpy(&slot->raw[i * ADXL345_SAMPLE_SIZE], &slot->rx[i][1], ADXL345_SAMPLE_SIZE);
+        adxl345_core_push(adxl345, slot->raw, slot->entries, slot->timestamp,
+                          slot->status_rx[0][1] & ADXL345_INT_OVERRUN);
+    } else {
+        adxl345_core_bus_error(adxl345, slot->msg.status);
+    }
+    spin_unlock_irqrestore(&adxl345_spi->push_lock, flags);
 
-    switch (cmd) {
-        case ADXL345_IOC_SET_RANGE:
-            // if (arg > 0x03) return -EINVAL;
-            // mutex_lock(&adxl345->buf_lock);
-            // // adxl345_send_command(adxl345, 0x31); // Set range command
-            // // adxl345_send_command(adxl345, (__u8)arg);
-            // mutex_unlock(&adxl345->buf_lock);
-            break;
+    if (!chained)
+        adxl345_core_drain_done(adxl345);
+    if (atomic_dec_and_test(&adxl345_spi->inflight))
+        wake_up(&adxl345_spi->flush_wait);
+}
 
-        default:
-            return -ENOTTY;
-    }
+static void adxl345_spi_drain_flush(void *bus)
+{
+    struct adxl345_spi *adxl345_spi = bus;
 
-    return status;
+    wait_event(adxl345_spi->flush_wait, atomic_read(&adxl345_spi->inflight) == 0);
 }
 
-// File operations structure
-static const struct file_operations adxl345_fops = {
-    .owner = THIS_MODULE,
-    .open = adxl345_open,
-    .release = adxl345_release,
-    .write = adxl345_write,
-    .unlocked_ioctl = adxl345_ioctl,
-    .llseek = no_llseek,
+static const struct adxl345_bus_ops adxl345_spi_ops = {
+    .read_regs  = adxl345_spi_read_regs,
+    .write_reg  = adxl345_spi_write_reg,
+    .burst_read = adxl345_spi_burst_read,
+};
+
+static const struct adxl345_bus_ops adxl345_spi_async_ops = {
+    .read_regs      = adxl345_spi_read_regs,
+    .write_reg      = adxl345_spi_write_reg,
+    .burst_read     = adxl345_spi_burst_read,
+    .drain_async    = adxl345_spi_drain_async,
+    .drain_flush    = adxl345_spi_drain_flush,
 };
 
 // Probe function
 static int adxl345_probe(struct spi_device *spi) 
 {
-    struct adxl345_data *adxl345;
+    struct adxl345_spi *adxl345_spi;
     int status;
-    unsigned long minor;
-    struct device *dev;
 
-    adxl345 = kzalloc(sizeof(*adxl345), GFP_KERNEL);
-    if (!adxl345)
+    adxl345_spi = devm_kzalloc(&spi->dev, sizeof(*adxl345_spi), GFP_KERNEL);
+    if (!adxl345_spi)
         return -ENOMEM;
 
-    adxl345->spi = spi;
-    mutex_init(&adxl345->buf_lock);
-    INIT_LIST_HEAD(&adxl345->device_entry);
-
-    // Initialize the mode and other settings if needed
-    adxl345->mode = 0; // Set appropriate mode
-    adxl345->speed_hz = spi->max_speed_hz;
-
-    minor = find_first_zero_bit(minors, N_SPI_MINORS);
-    if (minor < N_SPI_MINORS) {
-        set_bit(minor, minors);
-        adxl345->devt = MKDEV(ADXL345_MAJOR, minor);
-        dev = device_create(adxl345_class, &spi->dev, adxl345->devt, adxl345, "adxl345_spi%d.%d", spi->master->bus_num, spi->chip_select);
-        status = IS_ERR(dev) ? PTR_ERR(dev) : 0;
-    } else {
-        dev_dbg(&spi->dev, "no minor number available!\n");
-        status = -ENODEV;
-    }
-
-    if (status == 0) {
-        list_add(&adxl345->device_entry, &device_list);
-        spi_set_drvdata(spi, adxl345);
-    } else {
-        kfree(adxl345);
-    }
+    // The ADXL345 uses CPOL=1, CPHA=1
+    spi->mode = SPI_MODE_3;
+    status = spi_setup(spi);
+    if (status < 0)
+        return status;
 
-    return status;
+    adxl345_spi->spi = spi;
+    adxl345_spi_init_msgs(adxl345_spi);
+    // Before the core probe: its IRQ and PM callbacks may run before it returns
+    spi_set_drvdata(spi, adxl345_spi);
+    adxl345_spi->adxl345 = adxl345_core_probe(&spi->dev,
+                                              use_async ? &adxl345_spi_async_ops : &adxl345_spi_ops,
+                                              adxl345_spi, spi->irq);
+    if (IS_ERR(adxl345_spi->adxl345))
+        return PTR_ERR(adxl345_spi->adxl345);
+    return 0;
 }
 
 // Remove function
 static void adxl345_remove(struct spi_device *spi)
 {
-    struct adxl345_data *adxl345 = spi_get_drvdata(spi);
-
-    // Prevent new opens
-    mutex_lock(&device_list_lock);
-    // Make sure ops on existing fds can abort cleanly
-    mutex_lock(&adxl345->spi_lock);
-    adxl345->spi = NULL;
-    mutex_unlock(&adxl345->spi_lock);
-
-    list_del(&adxl345->device_entry);
-    device_destroy(adxl345_class, adxl345->devt);
-    clear_bit(MINOR(adxl345->devt), minors);
-    if (adxl345->users == 0)
-        kfree(adxl345);
-
-    mutex_unlock(&device_list_lock);
+    struct adxl345_spi *adxl345_spi = spi_get_drvdata(spi);
+
+    adxl345_core_remove(adxl345_spi->adxl345);
 }
 
+static const struct spi_device_id adxl345_spi_id[] = {
+    { "adxl345", 0 },
+    { }
+};
+MODULE_DEVICE_TABLE(spi, adxl345_spi_id);
+
+static const struct of_device_id adxl345_of_match[] = {
+    { .compatible = "analog,adxl345", },
+    { },
+};
+MODULE_DEVICE_TABLE(of, adxl345_of_match);
+
 // SPI driver structure
 static struct spi_driver adxl345_driver = {
     .driver = {
-        .name = "adxl345",
+        .name = "adxl345_spi",
         .owner = THIS_MODULE,
+        .of_match_table = of_match_ptr(adxl345_of_match),
+        .pm = pm_ptr(&adxl345_pm_ops),
     },
     .probe = adxl345_probe,
     .remove = adxl345_remove,
+    .id_table = adxl345_spi_id,
 };
 
-// Send command function
-static int adxl345_send_command(struct adxl345_data *adxl345, u8 command) {
-    int ret;
-    struct spi_message msg;
-    struct spi_transfer xfer = {
-        .tx_buf = &command,
-        .len = 1,
-        .cs_change = 0,
-    };
-
-    mutex_lock(&adxl345->spi_lock);
-    if (!adxl345->spi) {
-        mutex_unlock(&adxl345->spi_lock);
-        return -ENODEV;
-    }
-
-    spi_message_init(&msg);
-    spi_message_add_tail(&xfer, &msg);
-    ret = spi_sync(adxl345->spi, &msg);
-    mutex_unlock(&adxl345->spi_lock);
-
-    return ret;
-}
-
-// Send data function
-static int adxl345_send_data(struct adxl345_data *adxl345, const u8 *data, size_t len) {
-    int ret;
-    struct spi_message msg;
-    struct spi_transfer xfer = {
-        .tx_buf = data,
-        .len = len,
-        .cs_change = 0,
-    };
-
-    mutex_lock(&adxl345->spi_lock);
-    if (!adxl345->spi) {
-        mutex_unlock(&adxl345->spi_lock);
-        return -ENODEV;
-    }
-
-    spi_message_init(&msg);
-    spi_message_add_tail(&xfer, &msg);
-    ret = spi_sync(adxl345->spi, &msg);
-    mutex_unlock(&adxl345->spi_lock);
-
-    return ret;
-}
-
-// Module init function
-static int __init adxl345_init(void) 
-{
-    int status;
-    printk(KERN_INFO "Initiate ADXL345 SPI Driver.\n");
-    adxl345_class = class_create(THIS_MODULE, "adxl345_driver");
-    if (IS_ERR(adxl345_class)) {
-        return PTR_ERR(adxl345_class);
-    }
-
-    status = register_chrdev(ADXL345_MAJOR, "adxl345_driver", &adxl345_fops);
-    if (status < 0) {
-        class_destroy(adxl345_class);
-        return status;
-    }
-
-    status = spi_register_driver(&adxl345_driver);
-    if (status < 0) {
-        unregister_chrdev(ADXL345_MAJOR, adxl345_driver.driver.name);
-        class_destroy(adxl345_class);
-    }
-
-    return status;
-}
-
-// Module exit function
-static void __exit adxl345_exit(void) 
-{
-    spi_unregister_driver(&adxl345_driver);
-    unregister_chrdev(ADXL345_MAJOR, adxl345_driver.driver.name);
-    class_destroy(adxl345_class);
-}
-
-module_init(adxl345_init);
-module_exit(adxl345_exit);
+module_spi_driver(adxl345_driver);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Your Name");
 MODULE_DESCRIPTION("ADXL345 SPI Driver");
 MODULE_VERSION("1.0");
-
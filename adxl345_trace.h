@@ -0,0 +1,106 @@
+/*
+ * Tracepoints for the acquisition path: every register transfer the
+ * regmap issues, every FIFO burst, and every batch handed to the ring.
+ * The Kbuild file adds -I$(src) for adxl345_core.o so define_trace.h finds
+ * this file. Uses the one-argument __assign_str() of 6.10+ (target: 6.12).
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM adxl345
+
+#if !defined(ADXL345_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define ADXL345_TRACE_H
+
+#include <linux/device.h>
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(adxl345_bus_read,
+    TP_PROTO(struct device *dev, u8 reg, size_t len, int ret, u64 duration_ns),
+    TP_ARGS(dev, reg, len, ret, duration_ns),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(u8, reg)
+        __field(size_t, len)
+        __field(int, ret)
+        __field(u64, duration_ns)
+    ),
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->reg = reg;
+        __entry->len = len;
+        __entry->ret = ret;
+        __entry->duration_ns = duration_ns;
+    ),
+    TP_printk("%s reg=0x%02x len=%zu ret=%d duration=%lluns", __get_str(dev),
+              __entry->reg, __entry->len, __entry->ret, __entry->duration_ns)
+);
+
+TRACE_EVENT(adxl345_bus_write,
+    TP_PROTO(struct device *dev, u8 reg, u8 val, int ret, u64 duration_ns),
+    TP_ARGS(dev, reg, val, ret, duration_ns),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(u8, reg)
+        __field(u8, val)
+        __field(int, ret)
+        __field(u64, duration_ns)
+    ),
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->reg = reg;
+        __entry->val = val;
+        __entry->ret = ret;
+        __entry->duration_ns = duration_ns;
+    ),
+    TP_printk("%s reg=0x%02x val=0x%02x ret=%d duration=%lluns", __get_str(dev),
+              __entry->reg, __entry->val, __entry->ret, __entry->duration_ns)
+);
+
+TRACE_EVENT(adxl345_burst_read,
+    TP_PROTO(struct device *dev, unsigned int entries, int ret, u64 duration_ns),
+    TP_ARGS(dev, entries, ret, duration_ns),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(unsigned int, entries)
+        __field(int, ret)
+        __field(u64, duration_ns)
+    ),
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->entries = entries;
+        __entry->ret = ret;
+        __entry->duration_ns = duration_ns;
+    ),
+    TP_printk("%s entries=%u ret=%d duration=%lluns", __get_str(dev),
+              __entry->entries, __entry->ret, __entry->duration_ns)
+);
+
+// A drained batch reaching the core; latency runs from the watermark IRQ
+TRACE_EVENT(adxl345_fifo_drain,
+    TP_PROTO(struct device *dev, unsigned int entries, bool overrun, unsigned int ring_used,
+             u64 latency_ns),
+    TP_ARGS(dev, entries, overrun, ring_used, latency_ns),
+    TP_STRUCT__entry(
+        __string(dev, dev_name(dev))
+        __field(unsigned int, entries)
+        __field(bool, overrun)
+        __field(unsigned int, ring_used)
+        __field(u64, latency_ns)
+    ),
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->entries = entries;
+        __entry->overrun = overrun;
+        __entry->ring_used = ring_used;
+        __entry->latency_ns = latency_ns;
+    ),
+    TP_printk("%s entries=%u overrun=%d ring_used=%u latency=%lluns", __get_str(dev),
+              __entry->entries, __entry->overrun, __entry->ring_used, __entry->latency_ns)
+);
+
+#endif /* ADXL345_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE adxl345_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "adxl345_ioctl.h"
+
+/*
+ * Benchmark for the driver's access modes. Runs against real hardware or the
+ * emulated transport (insmod adxl345_emul.ko sensors=2) and reports, per mode:
+ * samples/sec, CPU time per sample, syscalls per sample and the p50/p99
+ * delivery latency (time the sample reached userspace minus its timestamp).
+ */
+
+#define DEVICE_PATH "/dev/adxl345"
+#define GROUP_PATH  "/dev/adxl345_group"
+#define BATCH       64
+#define MAX_LATENCIES (1 << 22)
+
+struct bench {
+    const char *name;
+    uint64_t samples;
+    uint64_t syscalls;
+    uint64_t overruns;
+    uint64_t *latency;      // ns, one per sample until MAX_LATENCIES
+    size_t nlatency;
+};
+
+static const char *device = DEVICE_PATH;
+static unsigned int seconds = 5;
+static unsigned int wakeup = 16;
+static int rate = -1;       // BW_RATE code, -1 leaves the current rate
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t cpu_ns(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+static void record(struct bench *b, int64_t timestamp_ns, uint16_t flags, uint64_t now)
+{
+    b->samples++;
+    if (flags & ADXL345_SAMPLE_OVERRUN)
+        b->overruns++;
+    if (b->nlatency < MAX_LATENCIES && (int64_t)now >= timestamp_ns)
+        b->latency[b->nlatency++] = now - timestamp_ns;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(struct bench *b, unsigned int pct)
+{
+    if (!b->nlatency)
+        return 0;
+    return b->latency[(b->nlatency - 1) * pct / 100];
+}
+
+static int open_device(const char *path)
+{
+    int fd = open(path, O_RDWR);
+
+    if (fd < 0)
+        perror(path);
+    return fd;
+}
+
+// Single-shot READ_XYZ: one syscall and one bus transfer per sample
+static int bench_ioctl(struct bench *b, int fd, uint64_t end)
+{
+    struct adxl345_sample sample;
+
+    while (now_ns() < end) {
+        b->syscalls++;
+        if (ioctl(fd, ADXL345_IOCTL_READ_XYZ, &sample) < 0) {
+            perror("ADXL345_IOCTL_READ_XYZ");
+            return -1;
+        }
+        record(b, sample.timestamp_ns, sample.flags, now_ns());
+    }
+    return 0;
+}
+
+// Blocking read() of up to BATCH records, woken after 'wakeup' samples
+static int bench_read(struct bench *b, int fd, uint64_t end)
+{
+    struct adxl345_sample buf[BATCH];
+    uint64_t now;
+    ssize_t len;
+    ssize_t i;
+
+    while ((now = now_ns()) < end) {
+        b->syscalls++;
+        len = read(fd, buf, sizeof(buf));
+        if (len < 0) {
+            perror("read");
+            return -1;
+        }
+        now = now_ns();
+        for (i = 0; i < len / (ssize_t)sizeof(buf[0]); i++)
+            record(b, buf[i].timestamp_ns, buf[i].flags, now);
+    }
+    return 0;
+}
+
+// poll() for a wake-up batch, then drain with non-blocking read()
+static int bench_poll(struct bench *b, int fd, uint64_t end)
+{
+    struct adxl345_sample buf[BATCH];
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    uint64_t now;
+    ssize_t len;
+    ssize_t i;
+
+    while (now_ns() < end) {
+        b->syscalls++;
+        if (poll(&pfd, 1, 1000) < 0) {
+            perror("poll");
+            return -1;
+        }
+        if (!(pfd.revents & POLLIN))
+            continue;
+        b->syscalls++;
+        len = read(fd, buf, sizeof(buf));
+        if (len < 0) {
+            perror("read");
+            return -1;
+        }
+        now = now_ns();
+        for (i = 0; i < len / (ssize_t)sizeof(buf[0]); i++)
+            record(b, buf[i].timestamp_ns, buf[i].flags, now);
+    }
+    return 0;
+}
+
+// Zero-copy: poll() for a batch, then consume the shared ring in place
+static int bench_mmap(struct bench *b, int fd, uint64_t end)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct adxl345_ring_ctrl *ctrl;
+    struct adxl345_sample *ring;
+    uint32_t head, tail;
+    uint64_t now;
+    void *area;
+    size_t size;
+    long page = sysconf(_SC_PAGESIZE);
+
+    // Map the control page first to learn the full size
+    area = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (area == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    b->syscalls++;
+    ctrl = area;
+    size = ctrl->mmap_size;
+    munmap(area, page);
+    area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (area == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    b->syscalls++;
+    ctrl = area;
+    ring = (struct adxl345_sample *)((char *)area + ctrl->data_offset);
+
+    while (now_ns() < end) {
+        b->syscalls++;
+        if (poll(&pfd, 1, 1000) < 0) {
+            perror("poll");
+            break;
+        }
+        head = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE);
+        tail = ctrl->tail;
+        now = now_ns();
+        for (; tail != head; tail++) {
+            struct adxl345_sample *s = &ring[tail & (ctrl->size - 1)];
+
+            record(b, s->timestamp_ns, s->flags, now);
+        }
+        __atomic_store_n(&ctrl->tail, tail, __ATOMIC_RELEASE);
+    }
+    munmap(area, size);
+    return 0;
+}
+
+// Group device: frames of every emulated sensor merged by timestamp
+static int bench_group(struct bench *b, int fd, uint64_t end)
+{
+    struct adxl345_group_config config = { .members = 0x3, .tolerance_ns = 2000000 };
+    size_t frame_size = ADXL345_FRAME_SIZE(2);
+    char buf[BATCH * ADXL345_FRAME_SIZE(2)];
+    struct adxl345_frame *frame;
+    uint64_t now;
+    ssize_t len;
+    ssize_t off;
+
+    b->syscalls++;
+    if (ioctl(fd, ADXL345_IOCTL_GROUP_SET, &config) < 0) {
+        perror("ADXL345_IOCTL_GROUP_SET");
+        return -1;
+    }
+    while (now_ns() < end) {
+        b->syscalls++;
+        len = read(fd, buf, sizeof(buf));
+        if (len < 0) {
+            perror("read");
+            return -1;
+        }
+        now = now_ns();
+        for (off = 0; off + (ssize_t)frame_size <= len; off += frame_size) {
+            frame = (struct adxl345_frame *)(buf + off);
+            record(b, frame->timestamp_ns, frame->flags, now);
+        }
+    }
+    return 0;
+}
+
+struct mode {
+    const char *name;
+    int (*run)(struct bench *b, int fd, uint64_t end);
+    int group;
+};
+
+static const struct mode modes[] = {
+    { "ioctl", bench_ioctl, 0 },
+    { "read",  bench_read,  0 },
+    { "poll",  bench_poll,  0 },
+    { "mmap",  bench_mmap,  0 },
+    { "group", bench_group, 1 },
+};
+
+static int run_mode(const struct mode *mode)
+{
+    struct bench b = { .name = mode->name };
+    uint64_t start, cpu, elapsed;
+    int fd, ret;
+
+    fd = open_device(mode->group ? GROUP_PATH : device);
+    if (fd < 0)
+        return -1;
+
+    // Streaming modes batch wake-ups; ioctl mode must stay unbatched
+    if (!mode->group && ioctl(fd, ADXL345_IOCTL_SET_WAKEUP, &(__u32){ strcmp(mode->name, "ioctl") ? wakeup : 1 }) < 0)
+        perror("ADXL345_IOCTL_SET_WAKEUP");
+    if (rate >= 0 && !mode->group) {
+        struct adxl345_config config;
+
+        if (ioctl(fd, ADXL345_IOCTL_GET_CONFIG, &config) < 0 ||
+            (config.rate = rate, ioctl(fd, ADXL345_IOCTL_SET_CONFIG, &config) < 0))
+            perror("ADXL345_IOCTL_SET_CONFIG");
+    }
+
+    b.latency = malloc(MAX_LATENCIES * sizeof(*b.latency));
+    if (!b.latency) {
+        close(fd);
+        return -1;
+    }
+
+    cpu = cpu_ns();
+    start = now_ns();
+    ret = mode->run(&b, fd, start + seconds * 1000000000ULL);
+    elapsed = now_ns() - start;
+    cpu = cpu_ns() - cpu;
+    close(fd);
+
+    qsort(b.latency, b.nlatency, sizeof(*b.latency), cmp_u64);
+    if (ret == 0 && b.samples)
+        printf("%-6s %10.1f %10.0f %10.3f %10.1f %10.1f %8llu\n", b.name,
+               b.samples * 1e9 / elapsed, (double)cpu / b.samples,
+               (double)b.syscalls / b.samples,
+               percentile(&b, 50) / 1e3, percentile(&b, 99) / 1e3,
+               (unsigned long long)b.overruns);
+    else if (ret == 0)
+        printf("%-6s no samples\n", b.name);
+    free(b.latency);
+    return ret;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-d device] [-t seconds] [-w wakeup] [-r bw_rate] [mode...]\n"
+            "Modes: ioctl read poll mmap group (default: all but group)\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int i;
+    int opt, ret = 0;
+
+    while ((opt = getopt(argc, argv, "d:t:w:r:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        case 't':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            wakeup = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rate = strtol(optarg, NULL, 0) & 0x0F;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : EINVAL;
+        }
+    }
+
+    printf("%-6s %10s %10s %10s %10s %10s %8s\n",
+           "mode", "samples/s", "cpu ns/smp", "sysc/smp", "p50 us", "p99 us", "overrun");
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        int selected = optind == argc && !modes[i].group;
+        int j;
+
+        for (j = optind; j < argc; j++)
+            selected |= !strcmp(argv[j], modes[i].name);
+        if (selected && run_mode(&modes[i]) < 0)
+            ret = 1;
+    }
+    return ret;
+}
@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libadxl345.h"
+
+/*
+ * Long-term capture in the driver's packed read() format, and offline
+ * replay of the resulting files.
+ *
+ * A capture file is a struct capture_header followed by either
+ *  - CAPTURE_RAW: the driver's packed stream verbatim (6-byte records with
+ *    timestamp anchors, see adxl345_ioctl.h), or
+ *  - CAPTURE_BLOCKS: struct capture_block headers, each followed by the
+ *    adxl345_block_encode() payload of its samples padded to 8 bytes. A new
+ *    block starts at every driver anchor and every block_samples samples.
+ * Everything is host byte order (little-endian on the Pi). Replay mmap()s
+ * the file and walks it in place.
+ */
+
+#define DEVICE_PATH     "/dev/adxl345"
+#define CAPTURE_MAGIC   "ADXL345C"
+#define CAPTURE_VERSION 1
+#define CAPTURE_RAW     0
+#define CAPTURE_BLOCKS  1
+#define READ_BYTES      (64 * 1024)
+#define BLOCK_SAMPLES   1024
+
+struct capture_header {
+    char magic[8];
+    uint16_t version;
+    uint16_t mode;              // CAPTURE_*
+    uint32_t ug_per_lsb;        // Scale at capture start
+    uint32_t anchor_interval;
+    uint32_t block_samples;     // CAPTURE_BLOCKS: most samples in one block
+    uint64_t reserved;
+};
+
+struct capture_block {
+    int64_t timestamp_ns;       // First sample
+    uint32_t period_ns;
+    uint16_t samples;
+    uint16_t flags;             // ADXL345_SAMPLE_* of the first sample
+    uint32_t bytes;             // Encoded payload, before padding
+    uint32_t reserved;
+};
+
+#define PAD8(n)         (((n) + 7) & ~(size_t)7)
+
+static const char *device = DEVICE_PATH;
+static const char *output;
+static const char *replay;
+static unsigned int seconds;
+static unsigned int anchor_interval = ADXL345_ANCHOR_INTERVAL_DEFAULT;
+static unsigned int block_samples = BLOCK_SAMPLES;
+static int blocks;
+static int summary;
+static volatile sig_atomic_t stop;
+
+// Block being filled from the packed stream
+struct block_state {
+    FILE *out;
+    struct capture_block hdr;
+    struct adxl345_axes *samples;
+    uint8_t *payload;
+    uint64_t bytes;             // Written to the file so far
+};
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static int write_all(FILE *out, const void *buf, size_t len)
+{
+    return fwrite(buf, 1, len, out) == len ? 0 : -EIO;
+}
+
+static int block_flush(struct block_state *st)
+{
+    static const uint8_t zero[8];
+    size_t len;
+
+    if (!st->hdr.samples)
+        return 0;
+    len = adxl345_block_encode(st->samples, st->hdr.samples, st->payload);
+    st->hdr.bytes = len;
+    if (write_all(st->out, &st->hdr, sizeof(st->hdr)) < 0 ||
+        write_all(st->out, st->payload, len) < 0 ||
+        write_all(st->out, zero, PAD8(len) - len) < 0)
+        return -EIO;
+    st->bytes += sizeof(st->hdr) + PAD8(len);
+
+    // Without a new anchor the next block carries on the same timeline
+    st->hdr.timestamp_ns += (int64_t)st->hdr.samples * st->hdr.period_ns;
+    st->hdr.samples = 0;
+    st->hdr.flags = 0;
+    return 0;
+}
+
+// Split one read() worth of packed records into blocks
+static int block_feed(struct block_state *st, const uint8_t *buf, size_t len)
+{
+    const struct adxl345_axes *rec;
+    struct adxl345_anchor anchor;
+    size_t off = 0;
+    int ret;
+
+    while (off + sizeof(*rec) <= len) {
+        rec = (const struct adxl345_axes *)(buf + off);
+        if (rec->x == ADXL345_PACKED_MARKER) {
+            if (off + sizeof(anchor) > len)
+                return -EINVAL;
+            memcpy(&anchor, buf + off, sizeof(anchor));
+            ret = block_flush(st);
+            if (ret < 0)
+                return ret;
+            st->hdr.timestamp_ns = anchor.timestamp_ns;
+            st->hdr.period_ns = anchor.period_ns;
+            st->hdr.flags = anchor.flags;
+            off += sizeof(anchor);
+            continue;
+        }
+        st->samples[st->hdr.samples++] = *rec;
+        off += sizeof(*rec);
+        if (st->hdr.samples == block_samples) {
+            ret = block_flush(st);
+            if (ret < 0)
+                return ret;
+        }
+    }
+    return 0;
+}
+
+static int capture(void)
+{
+    struct capture_header hdr = { .version = CAPTURE_VERSION };
+    struct block_state st = { 0 };
+    struct adxl345_dev *dev;
+    struct sigaction sa;
+    uint64_t samples = 0, raw_bytes = 0;
+    time_t end = seconds ? time(NULL) + seconds : 0;
+    uint8_t *buf;
+    ssize_t len;
+    size_t i;
+    int ret = 0;
+
+    dev = adxl345_open(device, 0);
+    if (!dev) {
+        perror(device);
+        return 1;
+    }
+    st.out = fopen(output, "wb");
+    buf = malloc(READ_BYTES);
+    st.samples = malloc(block_samples * sizeof(*st.samples));
+    st.payload = malloc(ADXL345_BLOCK_MAX_BYTES(block_samples));
+    if (!st.out || !buf || !st.samples || !st.payload) {
+        perror(output);
+        ret = 1;
+        goto out;
+    }
+
+    ret = adxl345_set_format(dev, ADXL345_FORMAT_PACKED, anchor_interval);
+    if (ret < 0) {
+        fprintf(stderr, "SET_FORMAT: %s\n", strerror(-ret));
+        ret = 1;
+        goto out;
+    }
+    adxl345_set_wakeup(dev, 256);
+
+    memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+    hdr.mode = blocks ? CAPTURE_BLOCKS : CAPTURE_RAW;
+    hdr.ug_per_lsb = (uint32_t)(adxl345_mg_per_lsb(dev) * 1000.0f + 0.5f);
+    hdr.anchor_interval = anchor_interval;
+    hdr.block_samples = blocks ? block_samples : 0;
+    if (write_all(st.out, &hdr, sizeof(hdr)) < 0) {
+        ret = 1;
+        goto out;
+    }
+
+    // No SA_RESTART: a signal has to interrupt the blocking read()
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!stop && (!end || time(NULL) < end)) {
+        len = read(adxl345_fd(dev), buf, READ_BYTES);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            ret = 1;
+            break;
+        }
+        raw_bytes += len;
+        for (i = 0; i + sizeof(struct adxl345_axes) <= (size_t)len; i += sizeof(struct adxl345_axes)) {
+            if (((const struct adxl345_axes *)(buf + i))->x == ADXL345_PACKED_MARKER)
+                i += sizeof(struct adxl345_anchor) - sizeof(struct adxl345_axes);
+            else
+                samples++;
+        }
+        if (blocks ? block_feed(&st, buf, len) < 0 : write_all(st.out, buf, len) < 0) {
+            fprintf(stderr, "%s: write failed\n", output);
+            ret = 1;
+            break;
+        }
+    }
+    if (blocks && block_flush(&st) < 0)
+        ret = 1;
+    if (fclose(st.out) != 0)
+        ret = 1;
+    st.out = NULL;
+
+    printf("%llu samples, %llu bytes from the driver", (unsigned long long)samples,
+           (unsigned long long)raw_bytes);
+    if (blocks)
+        printf(", %llu bytes in blocks", (unsigned long long)st.bytes);
+    printf(" (%.2f bytes/sample)\n",
+           samples ? (double)(blocks ? st.bytes : raw_bytes) / samples : 0.0);
+
+out:
+    if (st.out)
+        fclose(st.out);
+    free(st.payload);
+    free(st.samples);
+    free(buf);
+    adxl345_close(dev);
+    return ret;
+}
+
+static void emit(int64_t timestamp_ns, const struct adxl345_axes *a, uint16_t flags,
+                 uint64_t *count)
+{
+    (*count)++;
+    if (!summary)
+        printf("%lld,%d,%d,%d,%u\n", (long long)timestamp_ns, a->x, a->y, a->z, flags);
+}
+
+static int replay_raw(const uint8_t *p, size_t len, uint64_t *count)
+{
+    struct adxl345_anchor anchor = { 0 };
+    const struct adxl345_axes *rec;
+    uint64_t n = 0;
+    size_t off = 0;
+
+    while (off + sizeof(*rec) <= len) {
+        rec = (const struct adxl345_axes *)(p + off);
+        if (rec->x == ADXL345_PACKED_MARKER) {
+            if (off + sizeof(anchor) > len)
+                return -EINVAL;
+            memcpy(&anchor, p + off, sizeof(anchor));
+            off += sizeof(anchor);
+            n = 0;
+            continue;
+        }
+        emit(anchor.timestamp_ns + (int64_t)n * anchor.period_ns, rec, n ? 0 : anchor.flags, count);
+        n++;
+        off += sizeof(*rec);
+    }
+    return 0;
+}
+
+static int replay_blocks(const uint8_t *p, size_t len, uint32_t max_samples, uint64_t *count)
+{
+    const struct capture_block *blk;
+    struct adxl345_axes *samples;
+    size_t off = 0;
+    unsigned int i;
+
+    samples = malloc((max_samples ? max_samples : 1) * sizeof(*samples));
+    if (!samples)
+        return -ENOMEM;
+    while (off + sizeof(*blk) <= len) {
+        blk = (const struct capture_block *)(p + off);
+        off += sizeof(*blk);
+        if (blk->samples > max_samples || blk->bytes > len - off ||
+            adxl345_block_decode(p + off, blk->bytes, samples, blk->samples) < 0) {
+            free(samples);
+            return -EINVAL;
+        }
+        for (i = 0; i < blk->samples; i++)
+            emit(blk->timestamp_ns + (int64_t)i * blk->period_ns, &samples[i],
+                 i ? 0 : blk->flags, count);
+        off += PAD8(blk->bytes);
+    }
+    free(samples);
+    return 0;
+}
+
+static int replay_file(void)
+{
+    const struct capture_header *hdr;
+    uint64_t count = 0;
+    struct stat st;
+    void *map;
+    int fd, ret;
+
+    fd = open(replay, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(replay);
+        return 1;
+    }
+    if ((size_t)st.st_size < sizeof(*hdr)) {
+        fprintf(stderr, "%s: not a capture file\n", replay);
+        close(fd);
+        return 1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    hdr = map;
+    if (memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) || hdr->version != CAPTURE_VERSION) {
+        fprintf(stderr, "%s: not a capture file\n", replay);
+        munmap(map, st.st_size);
+        return 1;
+    }
+    if (!summary)
+        printf("# ug_per_lsb=%u\ntimestamp_ns,x,y,z,flags\n", hdr->ug_per_lsb);
+    if (hdr->mode == CAPTURE_BLOCKS)
+        ret = replay_blocks((const uint8_t *)map + sizeof(*hdr), st.st_size - sizeof(*hdr),
+                            hdr->block_samples, &count);
+    else
+        ret = replay_raw((const uint8_t *)map + sizeof(*hdr), st.st_size - sizeof(*hdr), &count);
+    if (ret < 0)
+        fprintf(stderr, "%s: corrupt after %llu samples\n", replay, (unsigned long long)count);
+    if (summary)
+        printf("%llu samples\n", (unsigned long long)count);
+    munmap(map, st.st_size);
+    return ret < 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-d device] [-t seconds] [-a anchor_interval] [-z] [-b block_samples] -o file\n"
+            "       %s [-s] -r file\n"
+            "  -o  capture the packed stream into file until -t expires or SIGINT\n"
+            "  -z  store delta/varint blocks instead of the raw packed stream\n"
+            "  -r  replay a capture as CSV (-s: only count the samples)\n",
+            prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:o:r:t:a:b:zsh")) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'r':
+            replay = optarg;
+            break;
+        case 't':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            anchor_interval = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            block_samples = strtoul(optarg, NULL, 0);
+            break;
+        case 'z':
+            blocks = 1;
+            break;
+        case 's':
+            summary = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : EINVAL;
+        }
+    }
+    if (!output == !replay || block_samples < 1 || block_samples > UINT16_MAX) {
+        usage(argv[0]);
+        return EINVAL;
+    }
+    return replay ? replay_file() : capture();
+}
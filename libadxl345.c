@@ -0,0 +1,416 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "libadxl345.h"
+
+#define READ_CHUNK      256     // Records per read() when splitting into arrays
+
+struct adxl345_dev {
+    int fd;
+    unsigned int flags;
+    float mg_per_lsb;
+    // ADXL345_OPEN_MMAP only
+    void *area;
+    size_t area_size;
+    struct adxl345_ring_ctrl *ctrl;
+    const struct adxl345_sample *ring;
+};
+
+static int adxl345_map(struct adxl345_dev *dev)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    void *area;
+
+    // The control page tells how large the whole mapping is
+    area = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
+    if (area == MAP_FAILED)
+        return -errno;
+    dev->area_size = ((struct adxl345_ring_ctrl *)area)->mmap_size;
+    munmap(area, page);
+
+    area = mmap(NULL, dev->area_size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
+    if (area == MAP_FAILED)
+        return -errno;
+    dev->area = area;
+    dev->ctrl = area;
+    dev->ring = (const struct adxl345_sample *)((char *)area + dev->ctrl->data_offset);
+    return 0;
+}
+
+struct adxl345_dev *adxl345_open(const char *path, unsigned int flags)
+{
+    struct adxl345_config config;
+    struct adxl345_dev *dev;
+    int ret;
+
+    dev = calloc(1, sizeof(*dev));
+    if (!dev)
+        return NULL;
+    dev->flags = flags;
+    dev->fd = open(path, O_RDWR | ((flags & ADXL345_OPEN_NONBLOCK) ? O_NONBLOCK : 0));
+    if (dev->fd < 0)
+        goto err;
+
+    ret = adxl345_get_config(dev, &config);
+    if (ret < 0) {
+        close(dev->fd);
+        errno = -ret;
+        goto err;
+    }
+
+    if (flags & ADXL345_OPEN_MMAP) {
+        ret = adxl345_map(dev);
+        if (ret < 0) {
+            close(dev->fd);
+            errno = -ret;
+            goto err;
+        }
+    }
+    return dev;
+
+err:
+    ret = errno;
+    free(dev);
+    errno = ret;
+    return NULL;
+}
+
+void adxl345_close(struct adxl345_dev *dev)
+{
+    if (!dev)
+        return;
+    if (dev->area)
+        munmap(dev->area, dev->area_size);
+    close(dev->fd);
+    free(dev);
+}
+
+int adxl345_fd(const struct adxl345_dev *dev)
+{
+    return dev->fd;
+}
+
+// The driver picks the scale from its table whenever the configuration changes
+static int adxl345_update_scale(struct adxl345_dev *dev)
+{
+    struct adxl345_scale scale;
+
+    if (ioctl(dev->fd, ADXL345_IOCTL_GET_SCALE, &scale) < 0)
+        return -errno;
+    dev->mg_per_lsb = scale.ug_per_lsb / 1000.0f;
+    return 0;
+}
+
+int adxl345_get_config(struct adxl345_dev *dev, struct adxl345_config *config)
+{
+    if (ioctl(dev->fd, ADXL345_IOCTL_GET_CONFIG, config) < 0)
+        return -errno;
+    return adxl345_update_scale(dev);
+}
+
+int adxl345_set_config(struct adxl345_dev *dev, const struct adxl345_config *config)
+{
+    if (ioctl(dev->fd, ADXL345_IOCTL_SET_CONFIG, config) < 0)
+        return -errno;
+    return adxl345_update_scale(dev);
+}
+
+int adxl345_set_range(struct adxl345_dev *dev, unsigned int g, int full_res)
+{
+    struct adxl345_config config;
+    int ret;
+
+    ret = adxl345_get_config(dev, &config);
+    if (ret < 0)
+        return ret;
+    config.range_g = g;
+    config.flags &= ~ADXL345_CONFIG_FULL_RES;
+    if (full_res)
+        config.flags |= ADXL345_CONFIG_FULL_RES;
+    return adxl345_set_config(dev, &config);
+}
+
+int adxl345_set_rate(struct adxl345_dev *dev, unsigned int code)
+{
+    struct adxl345_config config;
+    int ret;
+
+    ret = adxl345_get_config(dev, &config);
+    if (ret < 0)
+        return ret;
+    config.rate = code;
+    return adxl345_set_config(dev, &config);
+}
+
+int adxl345_set_wakeup(struct adxl345_dev *dev, unsigned int samples)
+{
+    __u32 wakeup = samples;
+
+    return ioctl(dev->fd, ADXL345_IOCTL_SET_WAKEUP, &wakeup) < 0 ? -errno : 0;
+}
+
+int adxl345_set_decimation(struct adxl345_dev *dev, unsigned int ratio, unsigned int order)
+{
+    struct adxl345_decimation decimation = { .ratio = ratio, .order = order };
+
+    return ioctl(dev->fd, ADXL345_IOCTL_SET_DECIMATION, &decimation) < 0 ? -errno : 0;
+}
+
+float adxl345_mg_per_lsb(const struct adxl345_dev *dev)
+{
+    return dev->mg_per_lsb;
+}
+
+int adxl345_set_format(struct adxl345_dev *dev, unsigned int format, unsigned int anchor_interval)
+{
+    struct adxl345_format fmt = { .format = format, .anchor_interval = anchor_interval };
+
+    return ioctl(dev->fd, ADXL345_IOCTL_SET_FORMAT, &fmt) < 0 ? -errno : 0;
+}
+
+ssize_t adxl345_read_fifo(struct adxl345_dev *dev, struct adxl345_sample *buf, size_t n,
+                          unsigned int *flags)
+{
+    struct adxl345_fifo_read req = {
+        .samples = (uintptr_t)buf,
+        .max = n > ADXL345_FIFO_READ_MAX ? ADXL345_FIFO_READ_MAX : n,
+    };
+
+    if (ioctl(dev->fd, ADXL345_IOCTL_READ_FIFO, &req) < 0)
+        return -errno;
+    if (flags)
+        *flags = req.flags;
+    return req.count;
+}
+
+int adxl345_set_reader(struct adxl345_dev *dev, unsigned int policy)
+{
+    struct adxl345_reader_config config = { .policy = policy };
+
+    return ioctl(dev->fd, ADXL345_IOCTL_SET_READER, &config) < 0 ? -errno : 0;
+}
+
+int64_t adxl345_reader_dropped(struct adxl345_dev *dev)
+{
+    struct adxl345_reader_config config;
+
+    if (ioctl(dev->fd, ADXL345_IOCTL_GET_READER, &config) < 0)
+        return -errno;
+    return config.dropped;
+}
+
+// Wait for the wake-up batch unless the ring already holds samples
+static int adxl345_wait(struct adxl345_dev *dev)
+{
+    struct pollfd pfd = { .fd = dev->fd, .events = POLLIN };
+
+    if (dev->flags & ADXL345_OPEN_NONBLOCK)
+        return -EAGAIN;
+    while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR)
+            return -errno;
+    }
+    return (pfd.revents & (POLLERR | POLLHUP)) ? -EIO : 0;
+}
+
+/*
+ * Walk the mmap()ed ring from tail to head, handing each contiguous run of
+ * slots to the consumer, then release them by advancing tail.
+ */
+static ssize_t adxl345_ring_take(struct adxl345_dev *dev, size_t n,
+                                 void (*take)(void *ctx, const struct adxl345_sample *s,
+                                              size_t off, size_t count),
+                                 void *ctx)
+{
+    uint32_t mask = dev->ctrl->size - 1;
+    uint32_t head, tail;
+    size_t done = 0, chunk;
+    int ret;
+
+    for (;;) {
+        head = __atomic_load_n(&dev->ctrl->head, __ATOMIC_ACQUIRE);
+        tail = dev->ctrl->tail;
+        if (head != tail)
+            break;
+        ret = adxl345_wait(dev);
+        if (ret < 0)
+            return ret;
+    }
+
+    while (done < n && tail != head) {
+        chunk = dev->ctrl->size - (tail & mask);
+        if (chunk > head - tail)
+            chunk = head - tail;
+        if (chunk > n - done)
+            chunk = n - done;
+        take(ctx, &dev->ring[tail & mask], done, chunk);
+        tail += chunk;
+        done += chunk;
+    }
+    __atomic_store_n(&dev->ctrl->tail, tail, __ATOMIC_RELEASE);
+    return done;
+}
+
+static void adxl345_take_aos(void *ctx, const struct adxl345_sample *s, size_t off, size_t count)
+{
+    memcpy((struct adxl345_sample *)ctx + off, s, count * sizeof(*s));
+}
+
+ssize_t adxl345_read(struct adxl345_dev *dev, struct adxl345_sample *buf, size_t n)
+{
+    ssize_t len;
+
+    if (dev->area)
+        return adxl345_ring_take(dev, n, adxl345_take_aos, buf);
+
+    len = read(dev->fd, buf, n * sizeof(*buf));
+    if (len < 0)
+        return -errno;
+    return len / sizeof(*buf);
+}
+
+struct adxl345_soa {
+    int16_t *x, *y, *z;
+    int64_t *timestamp_ns;
+};
+
+static void adxl345_take_soa(void *ctx, const struct adxl345_sample *s, size_t off, size_t count)
+{
+    struct adxl345_soa *soa = ctx;
+
+    adxl345_deinterleave(s, count, soa->x + off, soa->y + off, soa->z + off,
+                         soa->timestamp_ns ? soa->timestamp_ns + off : NULL);
+}
+
+ssize_t adxl345_read_soa(struct adxl345_dev *dev, int16_t *x, int16_t *y, int16_t *z,
+                         int64_t *timestamp_ns, size_t n)
+{
+    struct adxl345_soa soa = { x, y, z, timestamp_ns };
+    struct adxl345_sample buf[READ_CHUNK];
+    size_t done = 0;
+    ssize_t got;
+
+    if (dev->area)
+        return adxl345_ring_take(dev, n, adxl345_take_soa, &soa);
+
+    // One read() when blocking; non-blocking keeps going while whole chunks come back
+    do {
+        got = read(dev->fd, buf, (n - done < READ_CHUNK ? n - done : READ_CHUNK) * sizeof(buf[0]));
+        if (got < 0) {
+            if (done && errno == EAGAIN)
+                break;
+            return done ? (ssize_t)done : -errno;
+        }
+        got /= sizeof(buf[0]);
+        adxl345_take_soa(&soa, buf, done, got);
+        done += got;
+    } while (got == READ_CHUNK && done < n && (dev->flags & ADXL345_OPEN_NONBLOCK));
+    return done;
+}
+
+void adxl345_deinterleave(const struct adxl345_sample *restrict in, size_t n,
+                          int16_t *restrict x, int16_t *restrict y, int16_t *restrict z,
+                          int64_t *restrict timestamp_ns)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        x[i] = in[i].x;
+        y[i] = in[i].y;
+        z[i] = in[i].z;
+    }
+    if (timestamp_ns) {
+        for (i = 0; i < n; i++)
+            timestamp_ns[i] = in[i].timestamp_ns;
+    }
+}
+
+// Straight-line int16 -> float multiply; vectorizes at -O2 -ftree-vectorize or -O3
+void adxl345_scale(const int16_t *restrict in, float *restrict out, size_t n, float scale)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        out[i] = (float)in[i] * scale;
+}
+
+void adxl345_to_mg(const struct adxl345_dev *dev, const int16_t *restrict in,
+                   float *restrict out, size_t n)
+{
+    adxl345_scale(in, out, n, dev->mg_per_lsb);
+}
+
+void adxl345_to_ms2(const struct adxl345_dev *dev, const int16_t *restrict in,
+                    float *restrict out, size_t n)
+{
+    adxl345_scale(in, out, n, dev->mg_per_lsb * ADXL345_STANDARD_GRAVITY / 1000.0f);
+}
+
+static uint8_t *adxl345_put_delta(uint8_t *out, int16_t value, int16_t prev)
+{
+    int32_t delta = (int32_t)value - prev;
+    uint32_t zz = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+
+    while (zz >= 0x80) {
+        *out++ = (uint8_t)(zz | 0x80);
+        zz >>= 7;
+    }
+    *out++ = (uint8_t)zz;
+    return out;
+}
+
+size_t adxl345_block_encode(const struct adxl345_axes *in, size_t n, uint8_t *out)
+{
+    struct adxl345_axes prev = { 0, 0, 0 };
+    uint8_t *p = out;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        p = adxl345_put_delta(p, in[i].x, prev.x);
+        p = adxl345_put_delta(p, in[i].y, prev.y);
+        p = adxl345_put_delta(p, in[i].z, prev.z);
+        prev = in[i];
+    }
+    return p - out;
+}
+
+// A delta spans at most 17 bits, so a varint is at most three bytes
+static const uint8_t *adxl345_get_delta(const uint8_t *in, const uint8_t *end,
+                                        int16_t *value, int16_t prev)
+{
+    uint32_t zz = 0;
+    unsigned int shift;
+
+    for (shift = 0; shift < 21; shift += 7) {
+        if (in == end)
+            return NULL;
+        zz |= (uint32_t)(*in & 0x7F) << shift;
+        if (!(*in++ & 0x80)) {
+            *value = (int16_t)(prev + (int32_t)((zz >> 1) ^ -(zz & 1)));
+            return in;
+        }
+    }
+    return NULL;
+}
+
+ssize_t adxl345_block_decode(const uint8_t *in, size_t len, struct adxl345_axes *out, size_t n)
+{
+    struct adxl345_axes prev = { 0, 0, 0 };
+    const uint8_t *p = in, *end = in + len;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!(p = adxl345_get_delta(p, end, &out[i].x, prev.x)) ||
+            !(p = adxl345_get_delta(p, end, &out[i].y, prev.y)) ||
+            !(p = adxl345_get_delta(p, end, &out[i].z, prev.z)))
+            return -EINVAL;
+        prev = out[i];
+    }
+    return p - in;
+}
@@ -0,0 +1,84 @@
+#ifndef LIBADXL345_H
+#define LIBADXL345_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "adxl345_ioctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Userspace client for /dev/adxl345*. Samples are fetched in batches either
+ * with read() or straight out of the mmap()ed driver ring, and can be split
+ * into structure-of-arrays buffers so the conversion kernels below vectorize.
+ * Functions returning int give 0 or a negative errno.
+ */
+
+struct adxl345_dev;
+
+#define ADXL345_OPEN_MMAP       0x0001  // Consume the shared ring in place instead of read()
+#define ADXL345_OPEN_NONBLOCK   0x0002  // Batch reads return -EAGAIN instead of waiting
+
+#define ADXL345_STANDARD_GRAVITY 9.80665f
+
+struct adxl345_dev *adxl345_open(const char *path, unsigned int flags);
+void adxl345_close(struct adxl345_dev *dev);
+int adxl345_fd(const struct adxl345_dev *dev);
+
+// Configuration: g-range 2/4/8/16, BW_RATE code (0x0F = 3200 Hz), wake-up batch
+int adxl345_get_config(struct adxl345_dev *dev, struct adxl345_config *config);
+int adxl345_set_config(struct adxl345_dev *dev, const struct adxl345_config *config);
+int adxl345_set_range(struct adxl345_dev *dev, unsigned int g, int full_res);
+int adxl345_set_rate(struct adxl345_dev *dev, unsigned int code);
+int adxl345_set_wakeup(struct adxl345_dev *dev, unsigned int samples);
+int adxl345_set_decimation(struct adxl345_dev *dev, unsigned int ratio, unsigned int order);
+float adxl345_mg_per_lsb(const struct adxl345_dev *dev);
+// read() record format, ADXL345_FORMAT_*; anchor_interval only matters for the packed one
+int adxl345_set_format(struct adxl345_dev *dev, unsigned int format, unsigned int anchor_interval);
+// What happens when this handle falls a full ring behind, ADXL345_READER_*
+int adxl345_set_reader(struct adxl345_dev *dev, unsigned int policy);
+// Samples this handle lost to ADXL345_READER_SKIP or DETACH, or a negative errno
+int64_t adxl345_reader_dropped(struct adxl345_dev *dev);
+
+// Batched reads; return the number of samples stored (at most n) or a negative errno
+ssize_t adxl345_read(struct adxl345_dev *dev, struct adxl345_sample *buf, size_t n);
+ssize_t adxl345_read_soa(struct adxl345_dev *dev, int16_t *x, int16_t *y, int16_t *z,
+                         int64_t *timestamp_ns, size_t n);
+// Polled mode for boards without INT1: drain the hardware FIFO in one call, flags gets ADXL345_FIFO_READ_*
+ssize_t adxl345_read_fifo(struct adxl345_dev *dev, struct adxl345_sample *buf, size_t n,
+                          unsigned int *flags);
+
+// Conversion kernels: out[i] = in[i] * scale, written so the compiler can vectorize them
+void adxl345_scale(const int16_t *in, float *out, size_t n, float scale);
+void adxl345_to_mg(const struct adxl345_dev *dev, const int16_t *in,
+                   float *out, size_t n);
+void adxl345_to_ms2(const struct adxl345_dev *dev, const int16_t *in,
+                    float *out, size_t n);
+
+// Array-of-structs to structure-of-arrays split of read() records
+void adxl345_deinterleave(const struct adxl345_sample *in, size_t n,
+                          int16_t *x, int16_t *y, int16_t *z,
+                          int64_t *timestamp_ns);
+
+/*
+ * Block codec for long captures: every axis is stored as the zigzag LEB128
+ * varint of its difference from the previous sample (the first one from 0),
+ * x, y, z interleaved. Slowly varying data takes 3 bytes per sample instead
+ * of 6; ADXL345_BLOCK_MAX_BYTES is the worst case.
+ */
+#define ADXL345_BLOCK_MAX_BYTES(n)  ((n) * 9)
+
+// Returns the bytes written to out, which must hold ADXL345_BLOCK_MAX_BYTES(n)
+size_t adxl345_block_encode(const struct adxl345_axes *in, size_t n, uint8_t *out);
+// Decodes n samples; returns the bytes consumed or -EINVAL if in is truncated or corrupt
+ssize_t adxl345_block_decode(const uint8_t *in, size_t len, struct adxl345_axes *out, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBADXL345_H